@@ -7,14 +7,16 @@
 #include <string.h>
 #include <assert.h>
 #include <sys/time.h>
+#include <GraphParser.h>
 
 // Number of nodes and edges
 uint32_t numNodes;
 uint32_t numEdges;
 
-// Mapping from node id to array of neighbouring node ids
-// First element of each array holds the number of neighbours
-uint32_t** neighbours;
+// The neighbours of node i are held at indices offsets[i] to
+// offsets[i+1]-1 of the dests array
+uint32_t* offsets;
+uint32_t* dests;
 
 // Mapping from node id to bit vector of reaching nodes
 uint64_t** reaching;
@@ -25,53 +27,21 @@ const uint64_t vectorSize = 6;
 
 void readGraph(const char* filename, bool undirected)
 {
-  // Read edges
-  FILE* fp = fopen(filename, "rt");
-  if (fp == NULL) {
-    fprintf(stderr, "Can't open '%s'\n", filename);
-    exit(EXIT_FAILURE);
-  }
-
   // Note: we use a "pull" algorithm (rather than "push") to
   // avoid parallel writes to the same address, hence we reverse
   // the direction of the edges here.
-
-  // Count number of nodes and edges
-  numEdges = 0;
-  numNodes = 0;
-  int ret;
-  while (1) {
-    uint32_t src, dst;
-    ret = fscanf(fp, "%d %d", &dst, &src);
-    if (ret == EOF) break;
-    numEdges++;
-    numNodes = src >= numNodes ? src+1 : numNodes;
-    numNodes = dst >= numNodes ? dst+1 : numNodes;
-  }
-  rewind(fp);
-
-  // Create mapping from node id to number of neighbours
-  uint32_t* count = (uint32_t*) calloc(numNodes, sizeof(uint32_t));
-  for (int i = 0; i < numEdges; i++) {
-    uint32_t src, dst;
-    ret = fscanf(fp, "%d %d", &dst, &src);
-    count[src]++;
-    if (undirected) count[dst]++;
-  }
-
-  // Create mapping from node id to neighbours
-  neighbours = (uint32_t**) calloc(numNodes, sizeof(uint32_t*));
-  rewind(fp);
-  for (int i = 0; i < numNodes; i++) {
-    neighbours[i] = (uint32_t*) calloc(count[i]+1, sizeof(uint32_t));
-    neighbours[i][0] = count[i];
-  }
-  for (int i = 0; i < numEdges; i++) {
-    uint32_t src, dst;
-    ret = fscanf(fp, "%d %d", &dst, &src);
-    neighbours[src][count[src]--] = dst;
-    if (undirected) neighbours[dst][count[dst]--] = src;
-  }
+  // Read edges
+  GraphParser parser;
+  if (! parser.parse(filename, GraphAuto,
+          GraphParseReverse | GraphParseReverseOrder |
+            (undirected ? GraphParseUndirected : 0)))
+    exit(EXIT_FAILURE);
+  numNodes = parser.numNodes;
+  // Report edges in the file, not including mirrored ones
+  numEdges = undirected ? parser.numEdges / 2 : parser.numEdges;
+  offsets = parser.offsets;
+  dests = parser.dests;
+  parser.offsets = parser.dests = NULL;
 
   // Create mapping from node id to bit vector of reaching nodes
   reaching = (uint64_t**) calloc(numNodes, sizeof(uint64_t*));
@@ -80,10 +50,6 @@ void readGraph(const char* filename, bool undirected)
     reaching[i] = (uint64_t*) calloc(vectorSize, sizeof(uint64_t));
     reachingNext[i] = (uint64_t*) calloc(vectorSize, sizeof(uint64_t));
   }
-
-  // Release
-  free(count);
-  fclose(fp);
 }
 
 // Compute sum of all shortest paths from given sources
@@ -118,9 +84,8 @@ uint64_t ssp(uint32_t numSources, uint32_t* sources)
     #pragma omp parallel for
     for (int i = 0; i < numNodes; i++) {
       // For each neighbour
-      uint32_t numNeighbours = neighbours[i][0];
-      for (int j = 1; j <= numNeighbours; j++) {
-        uint32_t n = neighbours[i][j];
+      for (uint32_t j = offsets[i]; j < offsets[i+1]; j++) {
+        uint32_t n = dests[j];
         if (!changed[n]) continue;
         // For each chunk
         for (int k = 0; k < vectorSize; k++)
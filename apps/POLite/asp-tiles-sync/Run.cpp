@@ -51,9 +51,9 @@ int main(int argc, char**argv)
   for (uint32_t t = 0; t < numTiles; t++) {
     uint32_t tileOffs = t*net.numNodes;
     for (uint32_t i = 0; i < net.numNodes; i++) {
-      uint32_t numNeighbours = net.neighbours[i][0];
+      uint32_t numNeighbours = net.fanOut(i);
       for (uint32_t j = 0; j < numNeighbours; j++)
-        graph.addEdge(i+tileOffs, 0, net.neighbours[i][j+1]+tileOffs);
+        graph.addEdge(i+tileOffs, 0, net.neighbour(i, j)+tileOffs);
     }
   }
 
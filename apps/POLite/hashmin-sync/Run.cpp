@@ -37,9 +37,9 @@ int main(int argc, char**argv)
 
   // Create connections in POETS graph
   for (uint32_t i = 0; i < net.numNodes; i++) {
-    uint32_t numNeighbours = net.neighbours[i][0];
+    uint32_t numNeighbours = net.fanOut(i);
     for (uint32_t j = 0; j < numNeighbours; j++)
-      graph.addEdge(i, 0, net.neighbours[i][j+1]);
+      graph.addEdge(i, 0, net.neighbour(i, j));
   }
 
   // Prepare mapping from graph to hardware
@@ -34,10 +34,10 @@ int main(int argc, char**argv)
 
   for (int t = 0; t < 100; t++) {
     for (int i = 0; i < net.numNodes; i++) {
-      uint32_t numNeighbours = net.neighbours[i][0];
+      uint32_t numNeighbours = net.fanOut(i);
       float acc = 0.0;
       for (uint32_t j = 0; j < numNeighbours; j++) {
-        uint32_t neighbour = net.neighbours[i][j+1];
+        uint32_t neighbour = net.neighbour(i, j);
         acc += heat[neighbour];
       }
       heatNext[i] = acc / (float) numNeighbours;
@@ -45,22 +45,22 @@ int main(int argc, char**argv)
 
   // Create connections in POETS graph
   for (uint32_t i = 0; i < net.numNodes; i++) {
-    uint32_t numNeighbours = net.neighbours[i][0];
+    uint32_t numNeighbours = net.fanOut(i);
     for (uint32_t j = 0; j < numNeighbours; j++) {
       float weight = excite[i] ? 0.5 * urand() : -urand();
-      graph.addLabelledEdge(weight, i, 0, net.neighbours[i][j+1]);
+      graph.addLabelledEdge(weight, i, 0, net.neighbour(i, j));
     }
   }
 
   // Add zero-weight back-edges for any directed edges
   // (For GALS synchronisation)
   for (uint32_t i = 0; i < net.numNodes; i++) {
-    for (uint32_t j = 0; j < net.neighbours[i][0]; j++) {
-      uint32_t n = net.neighbours[i][j+1];
+    for (uint32_t j = 0; j < net.fanOut(i); j++) {
+      uint32_t n = net.neighbour(i, j);
       // TODO: can be more efficient here
       bool needBackEdge = true;
-      for (uint32_t k = 0; k < net.neighbours[n][0]; k++)
-        if (net.neighbours[n][k+1] == i) needBackEdge = false;
+      for (uint32_t k = 0; k < net.fanOut(n); k++)
+        if (net.neighbour(n, k) == i) needBackEdge = false;
       if (needBackEdge) graph.addLabelledEdge(0.0, n, 0, i);
     }
   }
@@ -42,7 +42,7 @@ int main(int argc, char**argv)
   // Edge weights
   float** weight = new float* [net.numNodes];
   for (int i = 0; i < net.numNodes; i++) {
-    uint32_t numEdges = net.neighbours[i][0];
+    uint32_t numEdges = net.fanOut(i);
     weight[i] = new float [numEdges];
     for (int j = 0; j < numEdges; j++) {
       weight[i][j] = excite[i] ? 0.5 * urand() : -urand();
@@ -116,8 +116,8 @@ int main(int argc, char**argv)
       if (spike[i]) {
         spikes++;
         n->spikeCount++;
-        uint32_t numEdges = net.neighbours[i][0];
-        uint32_t* dst = &net.neighbours[i][1];
+        uint32_t numEdges = net.fanOut(i);
+        const uint32_t* dst = &net.dests[net.offsets[i]];
         for (int j = 0; j < numEdges; j++) {
           neuron[dst[j]].I += weight[i][j];
         }
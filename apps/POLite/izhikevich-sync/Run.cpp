@@ -47,10 +47,10 @@ int main(int argc, char**argv)
 
   // Create connections in POETS graph
   for (uint32_t i = 0; i < net.numNodes; i++) {
-    uint32_t numNeighbours = net.neighbours[i][0];
+    uint32_t numNeighbours = net.fanOut(i);
     for (uint32_t j = 0; j < numNeighbours; j++) {
       float weight = excite[i] ? 0.5 * urand() : -urand();
-      graph.addLabelledEdge(weight, i, 0, net.neighbours[i][j+1]);
+      graph.addLabelledEdge(weight, i, 0, net.neighbour(i, j));
     }
   }
 
@@ -22,7 +22,7 @@ int main(int argc, char**argv)
   srand(1);
   uint32_t** weights = new uint32_t* [net.numNodes];
   for (uint32_t i = 0; i < net.numNodes; i++) {
-    uint32_t numNeighbours = net.neighbours[i][0];
+    uint32_t numNeighbours = net.fanOut(i);
     weights[i] = new uint32_t [numNeighbours];
     for (uint32_t j = 0; j < numNeighbours; j++) {
       weights[i][j] = rand() % 100;
@@ -54,9 +54,9 @@ int main(int argc, char**argv)
   while (queueSize > 0) {
     for (int i = 0; i < queueSize; i++) {
       uint32_t me = queue[i];
-      uint32_t numNeighbours = net.neighbours[me][0];
+      uint32_t numNeighbours = net.fanOut(me);
       for (uint32_t j = 0; j < numNeighbours; j++) {
-        uint32_t neighbour = net.neighbours[me][j+1];
+        uint32_t neighbour = net.neighbour(me, j);
         uint32_t newDist = dist[me] + weights[me][j];
         if (newDist < dist[neighbour]) {
           dist[neighbour] = newDist;
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Convert a text graph (any format supported by GraphParser.h) to a
+// binary graph file (see GraphFile.h)
+//
+// Build: g++ -O2 -fopenmp -I ../../../include ConvertGraph.cpp -o ConvertGraph
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <EdgeList.h>
+
+int main(int argc, char *argv[])
+{
+  if (argc != 3) {
+    printf("Usage: ConvertGraph <edges.txt|graph.mtx|graph.metis> "
+           "<graph.bin>\n");
+    return -1;
+  }
+
+  // Read network
+  EdgeList net;
+  net.read(argv[1]);
+
+  // Write binary graph file
+  if (! net.writeBinary(argv[2])) {
+    fprintf(stderr, "Unable to write %s\n", argv[2]);
+    return -1;
+  }
+
+  printf("Nodes: %u, edges: %u\n", net.numNodes, net.numEdges);
+  return 0;
+}
@@ -72,6 +72,16 @@ int main()
           tinselSend(hostId, msgOut);
         }
       }
+      else if (cmd == ZeroCmd) {
+        // Store zeros to data memory
+        int n = msgIn->args[0];
+        for (int i = 0; i < n; i++) {
+          uint32_t* ptr = (uint32_t*) addrReg;
+          *ptr = 0;
+          lastDataStoreAddr = addrReg;
+          addrReg += 4;
+        }
+      }
       else if (cmd == SetAddrCmd) {
         // Set address register
         addrReg = msgIn->args[0];
@@ -4,6 +4,8 @@
 #include "MemFileReader.h"
 #include "PowerLink.h"
 #include "SocketUtils.h"
+#include "PCIeRing.h"
+#include "PCIeSession.h"
 
 #include <boot.h>
 #include <ctype.h>
@@ -11,6 +13,7 @@
 #include <sys/stat.h>
 #include <sys/file.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -20,9 +23,34 @@
 #include <limits.h>
 #include <string.h>
 #include <signal.h>
+#include <pthread.h>
 
-// Send buffer size (in flits)
-#define SEND_BUFFER_SIZE 8192
+// Size of each batch in the send buffer (in flits)
+#define SEND_BATCH_SIZE 8192
+
+// Number of batches in the send buffer
+#define SEND_BATCHES 8
+
+// Receive buffer size (in bytes)
+#define RECV_BUFFER_SIZE 1048576
+
+// A batch of flits in the send buffer
+// (Bytes from sent up to len are yet to be written)
+struct HostLinkSendBatch {
+  char* data;
+  int len;
+  int sent;
+};
+
+// Initialise a mutex that may be re-acquired by the thread holding it
+static void initRecursiveMutex(pthread_mutex_t* mutex)
+{
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
 
 // Function to connect to a PCIeStream UNIX domain socket
 static int connectToPCIeStream(const char* socketPath)
@@ -59,11 +87,41 @@ static int connectToPCIeStream(const char* socketPath)
   return sock;
 }
 
+#ifndef SIMULATE
+// Function to start a session with pciestreamd, claiming given boards
+static void startPCIeSession(int sock, uint32_t xLen, uint32_t yLen)
+{
+  PCIeSessionReq req;
+  req.magic = PCIeSessionMagic;
+  req.x = req.y = 0;
+  req.xLen = xLen;
+  req.yLen = yLen;
+  req.flags = 0;
+  socketBlockingPut(sock, (char*) &req, sizeof(req));
+  uint8_t reply;
+  socketBlockingGet(sock, (char*) &reply, 1);
+  if (reply == PCIeSessionBusy) {
+    fprintf(stderr, "PCIeStream daemon is being used by another process\n");
+    exit(EXIT_FAILURE);
+  }
+  else if (reply != PCIeSessionOK) {
+    fprintf(stderr, "PCIeStream daemon rejected session request\n");
+    exit(EXIT_FAILURE);
+  }
+}
+#endif
+
 // Internal constructor
 void HostLink::constructor(HostLinkParams p)
 {
   useExtraSendSlot = p.useExtraSendSlot;
 
+  // Initialise locks
+  initRecursiveMutex(&sendLock);
+  initRecursiveMutex(&recvLock);
+  initRecursiveMutex(&debugLock);
+  stdOutPolling = false;
+
   if (p.numBoxesX > TinselBoxMeshXLen || p.numBoxesY > TinselBoxMeshYLen) {
     fprintf(stderr, "Number of boxes requested exceeds those available\n");
     exit(EXIT_FAILURE);
@@ -85,14 +143,6 @@ void HostLink::constructor(HostLinkParams p)
   // Ignore SIGPIPE
   signal(SIGPIPE, SIG_IGN);
 
-  #ifdef SIMULATE
-    // Connect to simulator
-    pcieLink = connectToPCIeStream(PCIESTREAM_SIM);
-  #else
-    // Connect to pciestreamd
-    pcieLink = connectToPCIeStream(PCIESTREAM);
-  #endif
-
   // Create DebugLink
   DebugLinkParams debugLinkParams;
   debugLinkParams.numBoxesX = p.numBoxesX;
@@ -104,6 +154,34 @@ void HostLink::constructor(HostLinkParams p)
   meshXLen = debugLink->meshXLen;
   meshYLen = debugLink->meshYLen;
 
+  pcieRings = NULL;
+  #ifdef SIMULATE
+    // Connect to simulator
+    pcieLink = connectToPCIeStream(PCIESTREAM_SIM);
+  #else
+    // Connect to pciestreamd, via shared-memory rings if requested
+    char* transport = getenv("HOSTLINK_TRANSPORT");
+    if (transport == NULL || strcmp(transport, "socket") == 0)
+      pcieLink = connectToPCIeStream(PCIESTREAM);
+    else if (strcmp(transport, "ring") == 0)
+      pcieLink = connectToPCIeStream(PCIESTREAM_RING);
+    else {
+      fprintf(stderr, "Unknown HOSTLINK_TRANSPORT '%s'\n", transport);
+      exit(EXIT_FAILURE);
+    }
+    // Claim the whole board mesh, untagged
+    // (Boards can't be shared with another HostLink anyway, as
+    // boardctrld serves only one DebugLink connection per box)
+    startPCIeSession(pcieLink, meshXLen, meshYLen);
+    if (transport != NULL && strcmp(transport, "ring") == 0) {
+      pcieRings = new PCIeRing [2];
+      if (! ringReceive(pcieLink, pcieRings)) {
+        fprintf(stderr, "Failed to set up rings with PCIeStream daemon\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+  #endif
+
   // Allocate line buffers
   lineBuffer = new char**** [meshXLen];
   for (int x = 0; x < meshXLen; x++) {
@@ -135,8 +213,14 @@ void HostLink::constructor(HostLinkParams p)
 
   // Initialise send buffer
   useSendBuffer = false;
-  sendBuffer = new char [(1<<TinselLogBytesPerFlit) * SEND_BUFFER_SIZE];
-  sendBufferLen = 0;
+  sendBatches = new HostLinkSendBatch [SEND_BATCHES];
+  for (int i = 0; i < SEND_BATCHES; i++)
+    sendBatches[i].data = new char [SEND_BATCH_SIZE << TinselLogBytesPerFlit];
+  sendFirst = sendNumBatches = 0;
+
+  // Initialise receive buffer
+  recvBuffer = new char [RECV_BUFFER_SIZE];
+  recvStart = recvEnd = 0;
 
   // Run the self test
   if (! powerOnSelfTest()) {
@@ -175,6 +259,8 @@ HostLink::HostLink(HostLinkParams params)
 // Destructor
 HostLink::~HostLink()
 {
+  stopStdOutPoller();
+
   // Free line buffers
   for (int x = 0; x < meshXLen; x++) {
     for (int y = 0; y < meshYLen; y++) {
@@ -193,13 +279,19 @@ HostLink::~HostLink()
   delete [] lineBuffer;
   delete [] lineBufferLen;
 
-  // Free send buffer
-  delete [] sendBuffer;
+  // Free send and receive buffers
+  for (int i = 0; i < SEND_BATCHES; i++) delete [] sendBatches[i].data;
+  delete [] sendBatches;
+  delete [] recvBuffer;
 
   // Close debug link
   delete debugLink;
 
   // Close connection to the PCIe stream daemon
+  if (pcieRings) {
+    ringUnmap(pcieRings);
+    delete [] pcieRings;
+  }
   close(pcieLink);
 
   // Release HostLink lock
@@ -207,6 +299,10 @@ HostLink::~HostLink()
     perror("Failed to release HostLink lock");
   }
   close(lockFile);
+
+  pthread_mutex_destroy(&sendLock);
+  pthread_mutex_destroy(&recvLock);
+  pthread_mutex_destroy(&debugLock);
 }
 
 // Address construction
@@ -237,12 +333,124 @@ void HostLink::fromAddr(uint32_t addr, uint32_t* meshX, uint32_t* meshY,
   *meshY = addr;
 }
 
+// Send bytes to PCIeStream (blocking)
+void HostLink::pcieBlockingPut(char* buf, int numBytes)
+{
+  if (pcieRings == NULL) {
+    socketBlockingPut(pcieLink, buf, numBytes);
+    return;
+  }
+  PCIeRing* ring = &pcieRings[PCIeRingToFPGA];
+  for (;;) {
+    int n = ringPut(ring, buf, numBytes);
+    buf += n;
+    numBytes -= n;
+    if (numBytes == 0) return;
+    if (! ringWait(ring, false, pcieLink)) {
+      fprintf(stderr, "Error writing to PCIeStream ring\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+// Send bytes to PCIeStream if there is room for all of them
+bool HostLink::pciePut(char* buf, int numBytes)
+{
+  if (pcieRings == NULL) return socketPut(pcieLink, buf, numBytes) == 1;
+  PCIeRing* ring = &pcieRings[PCIeRingToFPGA];
+  if (ringSpace(ring) < (uint32_t) numBytes) return false;
+  ringPut(ring, buf, numBytes);
+  return true;
+}
+
+// Block until there may be room to send bytes to PCIeStream
+void HostLink::pcieWaitPut()
+{
+  if (pcieRings == NULL) {
+    struct pollfd fd; fd.fd = pcieLink; fd.events = POLLOUT;
+    poll(&fd, 1, -1);
+    return;
+  }
+  PCIeRing* ring = &pcieRings[PCIeRingToFPGA];
+  if (! ringWait(ring, false, pcieLink)) {
+    fprintf(stderr, "Error writing to PCIeStream ring\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Receive between 1 and maxBytes bytes from PCIeStream (blocking),
+// returning the number received
+int HostLink::pcieRead(char* buf, int maxBytes)
+{
+  if (pcieRings == NULL) {
+    int n = ::recv(pcieLink, buf, maxBytes, 0);
+    if (n <= 0) {
+      fprintf(stderr, "Error reading from socket\n");
+      exit(EXIT_FAILURE);
+    }
+    return n;
+  }
+  PCIeRing* ring = &pcieRings[PCIeRingFromFPGA];
+  for (;;) {
+    int n = ringGet(ring, buf, maxBytes);
+    if (n > 0) return n;
+    if (! ringWait(ring, true, pcieLink)) {
+      fprintf(stderr, "Error reading from PCIeStream ring\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+// Block until receive buffer holds at least numBytes
+void HostLink::recvFill(int numBytes)
+{
+  int avail = recvEnd - recvStart;
+  if (avail >= numBytes) return;
+  // Move unconsumed bytes to front of buffer
+  memmove(recvBuffer, &recvBuffer[recvStart], avail);
+  recvStart = 0;
+  recvEnd = avail;
+  while (recvEnd < numBytes)
+    recvEnd += pcieRead(&recvBuffer[recvEnd], RECV_BUFFER_SIZE - recvEnd);
+}
+
+// Receive bytes from PCIeStream (blocking)
+void HostLink::pcieBlockingGet(char* buf, int numBytes)
+{
+  // Take what we can from the receive buffer
+  int n = recvEnd - recvStart;
+  if (n > numBytes) n = numBytes;
+  memcpy(buf, &recvBuffer[recvStart], n);
+  recvStart += n;
+  buf += n;
+  numBytes -= n;
+  if (numBytes == 0) return;
+  // Large transfers bypass the (now empty) buffer
+  if (numBytes >= RECV_BUFFER_SIZE/2) {
+    while (numBytes > 0) {
+      n = pcieRead(buf, numBytes);
+      buf += n;
+      numBytes -= n;
+    }
+    return;
+  }
+  recvFill(numBytes);
+  memcpy(buf, &recvBuffer[recvStart], numBytes);
+  recvStart += numBytes;
+}
+
+// Can receive bytes from PCIeStream without blocking?
+bool HostLink::pcieCanGet()
+{
+  if (recvEnd > recvStart) return true;
+  if (pcieRings == NULL) return socketCanGet(pcieLink);
+  return ringAvailable(&pcieRings[PCIeRingFromFPGA]) > 0;
+}
+
 // Internal helper for sending messages
 bool HostLink::sendHelper(uint32_t dest, uint32_t numFlits, void* payload,
        bool block, uint32_t key)
 {
-  assert(useSendBuffer ? block : true);
-
   // Ensure that MaxFlitsPerMsg is not violated
   assert(numFlits > 0 && numFlits <= TinselMaxFlitsPerMsg);
 
@@ -250,12 +458,15 @@ bool HostLink::sendHelper(uint32_t dest, uint32_t numFlits, void* payload,
   // (Because PCIeStream currently has this assumption)
   assert(TinselLogBytesPerFlit == 4);
 
+  bool ok = true;
+  pthread_mutex_lock(&sendLock);
   if (useSendBuffer) {
-    // Flush the buffer when we run out of space
-    if ((sendBufferLen + numFlits + 1) >= SEND_BUFFER_SIZE) flush();
-
     // Message buffer
-    uint32_t* buffer = (uint32_t*) &sendBuffer[16*sendBufferLen];
+    uint32_t* buffer = (uint32_t*) sendReserve(16*(1+numFlits), block);
+    if (buffer == NULL) {
+      pthread_mutex_unlock(&sendLock);
+      return false;
+    }
 
     // Fill in the message header
     // (See DE5BridgeTop.bsv for details)
@@ -266,14 +477,9 @@ bool HostLink::sendHelper(uint32_t dest, uint32_t numFlits, void* payload,
 
     // Fill in message payload
     memcpy(&buffer[4], payload, numFlits*16);
-
-    // Update buffer
-    sendBufferLen += 1 + numFlits;
-
-    return true;
   }
   else {
-    assert(sendBufferLen == 0);
+    assert(sendNumBatches == 0);
 
     // Message buffer
     uint32_t buffer[4*(TinselMaxFlitsPerMsg+1)];
@@ -283,7 +489,7 @@ bool HostLink::sendHelper(uint32_t dest, uint32_t numFlits, void* payload,
     buffer[0] = dest;
     buffer[1] = 0;
     buffer[2] = (numFlits-1) << 24;
-    buffer[3] = 0;
+    buffer[3] = key;
 
     // Bytes in payload
     int payloadBytes = numFlits*16;
@@ -295,14 +501,13 @@ bool HostLink::sendHelper(uint32_t dest, uint32_t numFlits, void* payload,
     int totalBytes = 16+payloadBytes;
 
     // Write to the socket
-    if (block) {
-      socketBlockingPut(pcieLink, (char*) buffer, totalBytes);
-      return true;
-    }
-    else {
-      return socketPut(pcieLink, (char*) buffer, totalBytes) == 1;
-    }
+    if (block)
+      pcieBlockingPut((char*) buffer, totalBytes);
+    else
+      ok = pciePut((char*) buffer, totalBytes);
   }
+  pthread_mutex_unlock(&sendLock);
+  return ok;
 }
 
 
@@ -312,14 +517,116 @@ bool HostLink::send(uint32_t dest, uint32_t numFlits, void* msg, bool block)
   return sendHelper(dest, numFlits, msg, block, 0);
 }
 
+// Find room for numBytes at the end of the send buffer, returning a
+// pointer to it (or NULL if there is no room and block is false)
+char* HostLink::sendReserve(int numBytes, bool block)
+{
+  const int batchBytes = SEND_BATCH_SIZE << TinselLogBytesPerFlit;
+  HostLinkSendBatch* b;
+  if (sendNumBatches > 0) {
+    b = &sendBatches[(sendFirst + sendNumBatches - 1) % SEND_BATCHES];
+    if (b->len + numBytes <= batchBytes) {
+      b->len += numBytes;
+      return &b->data[b->len - numBytes];
+    }
+  }
+  // Newest batch is full, so write what we can before starting another
+  tryFlush();
+  while (sendNumBatches == SEND_BATCHES) {
+    if (! block) return NULL;
+    pcieWaitPut();
+    tryFlush();
+  }
+  b = &sendBatches[(sendFirst + sendNumBatches) % SEND_BATCHES];
+  sendNumBatches++;
+  b->len = numBytes;
+  b->sent = 0;
+  return b->data;
+}
+
+// Write as much of the send buffer as possible without blocking,
+// returning true if it is now empty
+bool HostLink::tryFlush()
+{
+  pthread_mutex_lock(&sendLock);
+
+  // Gather unwritten bytes of all batches
+  struct iovec iov[SEND_BATCHES];
+  int numIov = 0;
+  for (int i = 0; i < sendNumBatches; i++) {
+    HostLinkSendBatch* b = &sendBatches[(sendFirst + i) % SEND_BATCHES];
+    iov[numIov].iov_base = &b->data[b->sent];
+    iov[numIov].iov_len = b->len - b->sent;
+    numIov++;
+  }
+
+  if (numIov == 0) {
+    pthread_mutex_unlock(&sendLock);
+    return true;
+  }
+
+  // Write as many as possible
+  int written = 0;
+  if (pcieRings == NULL) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = numIov;
+    written = sendmsg(pcieLink, &msg, MSG_DONTWAIT);
+    if (written < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        fprintf(stderr, "Error writing to socket\n");
+        exit(EXIT_FAILURE);
+      }
+      written = 0;
+    }
+  }
+  else {
+    PCIeRing* ring = &pcieRings[PCIeRingToFPGA];
+    for (int i = 0; i < numIov; i++) {
+      int n = ringPut(ring, (char*) iov[i].iov_base, iov[i].iov_len);
+      written += n;
+      if (n < (int) iov[i].iov_len) break;
+    }
+  }
+
+  // Retire written batches
+  while (sendNumBatches > 0) {
+    HostLinkSendBatch* b = &sendBatches[sendFirst];
+    int n = b->len - b->sent;
+    if (written < n) {
+      b->sent += written;
+      break;
+    }
+    written -= n;
+    sendFirst = (sendFirst + 1) % SEND_BATCHES;
+    sendNumBatches--;
+  }
+  bool empty = sendNumBatches == 0;
+  pthread_mutex_unlock(&sendLock);
+  return empty;
+}
+
 // Flush the send buffer
 void HostLink::flush()
 {
   assert(useSendBuffer);
-  if (sendBufferLen > 0) {
-    socketBlockingPut(pcieLink, sendBuffer, sendBufferLen * 16);
-    sendBufferLen = 0;
+  pthread_mutex_lock(&sendLock);
+  while (! tryFlush()) pcieWaitPut();
+  pthread_mutex_unlock(&sendLock);
+}
+
+// Number of bytes in the send buffer yet to be written
+uint32_t HostLink::pendingBytes()
+{
+  uint32_t n = 0;
+  pthread_mutex_lock(&sendLock);
+  for (int i = 0; i < sendNumBatches; i++) {
+    HostLinkSendBatch* b = &sendBatches[(sendFirst + i) % SEND_BATCHES];
+    n += b->len - b->sent;
   }
+  pthread_mutex_unlock(&sendLock);
+  return n;
 }
 
 // Try to send a message (non-blocking, returns true on success)
@@ -353,47 +660,85 @@ bool HostLink::keyTrySend(uint32_t key, uint32_t numFlits, void* msg)
 void HostLink::recv(void* msg)
 {
   int numBytes = 1 << TinselLogBytesPerMsg;
-  socketBlockingGet(pcieLink, (char*) msg, numBytes);
+  pthread_mutex_lock(&recvLock);
+  pcieBlockingGet((char*) msg, numBytes);
+  pthread_mutex_unlock(&recvLock);
 }
 
 // Receive a message (blocking), given size of message in bytes
 void HostLink::recvMsg(void* msg, uint32_t numBytes)
 {
-  // Number of padding bytes that need to be received but not stored
-  int paddingBytes = (1 << TinselLogBytesPerMsg) - numBytes;
-
-  // Fill message
-  uint8_t* ptr = (uint8_t*) msg;
-  socketBlockingGet(pcieLink, (char*) ptr, numBytes);
-
-  // Discard padding bytes
-  uint8_t padding[1 << TinselLogBytesPerMsg];
-  socketBlockingGet(pcieLink, (char*) padding, paddingBytes);
+  // Padding bytes beyond numBytes are skipped
+  pthread_mutex_lock(&recvLock);
+  recvFill(1 << TinselLogBytesPerMsg);
+  memcpy(msg, &recvBuffer[recvStart], numBytes);
+  recvStart += 1 << TinselLogBytesPerMsg;
+  pthread_mutex_unlock(&recvLock);
 }
 
 // Receive multiple messages (blocking)
 void HostLink::recvBulk(int numMsgs, void* msgs)
 {
   int numBytes = numMsgs * (1 << TinselLogBytesPerMsg);
-  socketBlockingGet(pcieLink, (char*) msgs, numBytes);
+  pthread_mutex_lock(&recvLock);
+  pcieBlockingGet((char*) msgs, numBytes);
+  pthread_mutex_unlock(&recvLock);
 }
 
 // Receive multiple messages (blocking), given size of each message
 void HostLink::recvMsgs(int numMsgs, int msgSize, void* msgs)
 {
-  int numBytes = numMsgs * (1 << TinselLogBytesPerMsg);
-  uint8_t* buffer = new uint8_t [numBytes];
   uint8_t* ptr = (uint8_t*) msgs;
-  socketBlockingGet(pcieLink, (char*) buffer, numBytes);
-  for (int i = 0; i < numMsgs; i++)
-    memcpy(&ptr[i*msgSize], &buffer[i*(1<<TinselLogBytesPerMsg)], msgSize);
-  delete [] buffer;
+  pthread_mutex_lock(&recvLock);
+  while (numMsgs > 0) {
+    void* batch;
+    uint32_t n = recvBatch(numMsgs, &batch);
+    for (uint32_t i = 0; i < n; i++)
+      memcpy(&ptr[i*msgSize],
+             (uint8_t*) batch + (i << TinselLogBytesPerMsg), msgSize);
+    recvBatchDone();
+    ptr += n*msgSize;
+    numMsgs -= n;
+  }
+  pthread_mutex_unlock(&recvLock);
+}
+
+// Receive up to maxMsgs max-sized messages in place (blocking until
+// there is at least one), returning the number received
+// (The receive lock is held until recvBatchDone is called)
+uint32_t HostLink::recvBatch(uint32_t maxMsgs, void** msgs)
+{
+  pthread_mutex_lock(&recvLock);
+  recvFill(1 << TinselLogBytesPerMsg);
+  uint32_t n = (recvEnd - recvStart) >> TinselLogBytesPerMsg;
+  if (n > maxMsgs) n = maxMsgs;
+  *msgs = &recvBuffer[recvStart];
+  recvStart += n << TinselLogBytesPerMsg;
+  return n;
+}
+
+// Finish with the batch returned by recvBatch
+void HostLink::recvBatchDone()
+{
+  pthread_mutex_unlock(&recvLock);
 }
 
 // Can receive a flit without blocking?
 bool HostLink::canRecv()
 {
-  return socketCanGet(pcieLink);
+  pthread_mutex_lock(&recvLock);
+  bool ok = pcieCanGet();
+  pthread_mutex_unlock(&recvLock);
+  return ok;
+}
+
+// Does given core write its instruction memory during boot?
+// (If SharedInstrMem is set, cores 2n and 2n+1 in each tile share an
+// instruction memory, which is then written only via core 2n)
+static inline bool writesInstrMem(uint32_t coreId)
+{
+  uint32_t local = coreId & ((1 << TinselLogCoresPerDCache) - 1);
+  return !TinselSharedInstrMem || (local & 1) == 0;
 }
 
 // Load application code and data onto the mesh
@@ -402,19 +747,28 @@ void HostLink::boot(const char* codeFilename, const char* dataFilename)
   MemFileReader code(codeFilename);
   MemFileReader data(dataFilename);
 
-  // Request to boot loader
-  BootReq req;
+  // Requests to boot loader
+  // (Words are sent in runs of up to 15, the most one request can hold)
+  BootReq req, run;
+
+  // The boot loader does not respond to these, so send them buffered
+  pthread_mutex_lock(&sendLock);
+  bool buffered = useSendBuffer;
+  useSendBuffer = true;
 
   // Step 1: load code into instruction memory
   // -----------------------------------------
 
   uint32_t addrReg = 0xffffffff;
-  uint32_t addr, word;
-  while (code.getWord(&addr, &word)) {
-    // Send instruction to each core
+  uint32_t addr, n;
+  run.cmd = WriteInstrCmd;
+  while ((n = code.getRun(&addr, run.args, 15)) > 0) {
+    run.numArgs = n;
+    // Send instructions to each instruction memory
     for (int x = 0; x < meshXLen; x++) {
       for (int y = 0; y < meshYLen; y++) {
         for (int i = 0; i < (1 << TinselLogCoresPerBoard); i++) {
+          if (!writesInstrMem(i)) continue;
           uint32_t dest = toAddr(x, y, i, 0);
           if (addr != addrReg) {
             req.cmd = SetAddrCmd;
@@ -422,14 +776,11 @@ void HostLink::boot(const char* codeFilename, const char* dataFilename)
             req.args[0] = addr;
             send(dest, 1, &req);
           }
-          req.cmd = WriteInstrCmd;
-          req.numArgs = 1;
-          req.args[0] = word;
-          send(dest, 1, &req);
+          send(dest, 1 + (n >> 2), &run);
         }
       }
     }
-    addrReg = addr + 4;
+    addrReg = addr + 4*n;
   }
 
   // Step 2: initialise data memory
@@ -441,7 +792,9 @@ void HostLink::boot(const char* codeFilename, const char* dataFilename)
 
   // Write data to DRAMs
   addrReg = 0xffffffff;
-  while (data.getWord(&addr, &word)) {
+  run.cmd = StoreCmd;
+  while ((n = data.getRun(&addr, run.args, 15)) > 0) {
+    run.numArgs = n;
     for (int x = 0; x < meshXLen; x++) {
       for (int y = 0; y < meshYLen; y++) {
         for (int i = 0; i < TinselDRAMsPerBoard; i++) {
@@ -453,32 +806,35 @@ void HostLink::boot(const char* codeFilename, const char* dataFilename)
             req.args[0] = addr;
             send(dest, 1, &req);
           }
-          req.cmd = StoreCmd;
-          req.numArgs = 1;
-          req.args[0] = word;
-          send(dest, 1, &req);
+          send(dest, 1 + (n >> 2), &run);
         }
       }
     }
-    addrReg = addr + 4;
+    addrReg = addr + 4*n;
   }
 
+  flush();
+  useSendBuffer = buffered;
+
   // Step 3: start cores
   // -------------------
 
   // Send start command
   startAll();
+  pthread_mutex_unlock(&sendLock);
 }
 
 // Trigger to start application execution
 void HostLink::go()
 {
+  pthread_mutex_lock(&debugLock);
   for (int x = 0; x < meshXLen; x++) {
     for (int y = 0; y < meshYLen; y++) {
       debugLink->setBroadcastDest(x, y, 0);
       debugLink->put(x, y, 0);
     }
   }
+  pthread_mutex_unlock(&debugLock);
 }
 
 // Load instructions into given core's instruction memory
@@ -489,24 +845,25 @@ void HostLink::loadInstrsOntoCore(const char* codeFilename,
   MemFileReader code(codeFilename);
 
   // Load loop
-  BootReq req;
+  BootReq req, run;
   uint32_t addrReg = 0xffffffff;
-  uint32_t addr, word;
+  uint32_t addr, n;
   uint32_t dest = toAddr(meshX, meshY, coreId, 0);
-  while (code.getWord(&addr, &word)) {
-    // Write instruction
+  run.cmd = WriteInstrCmd;
+  pthread_mutex_lock(&sendLock);
+  while ((n = code.getRun(&addr, run.args, 15)) > 0) {
+    // Write instructions
     if (addr != addrReg) {
       req.cmd = SetAddrCmd;
       req.numArgs = 1;
       req.args[0] = addr;
       send(dest, 1, &req);
     }
-    req.cmd = WriteInstrCmd;
-    req.numArgs = 1;
-    req.args[0] = word;
-    send(dest, 1, &req);
-    addrReg = addr + 4;
+    run.numArgs = n;
+    send(dest, 1 + (n >> 2), &run);
+    addrReg = addr + 4*n;
   }
+  pthread_mutex_unlock(&sendLock);
 }
 
 // Load data via given core on given board
@@ -516,11 +873,13 @@ void HostLink::loadDataViaCore(const char* dataFilename,
   MemFileReader data(dataFilename);
 
   // Write data to DRAM
-  BootReq req;
+  BootReq req, run;
   uint32_t addrReg = 0xffffffff;
-  uint32_t addr, word;
+  uint32_t addr, n;
   uint32_t dest = toAddr(meshX, meshY, coreId, 0);
-  while (data.getWord(&addr, &word)) {
+  run.cmd = StoreCmd;
+  pthread_mutex_lock(&sendLock);
+  while ((n = data.getRun(&addr, run.args, 15)) > 0) {
     // Write data
     if (addr != addrReg) {
       req.cmd = SetAddrCmd;
@@ -528,12 +887,11 @@ void HostLink::loadDataViaCore(const char* dataFilename,
       req.args[0] = addr;
       send(dest, 1, &req);
     }
-    req.cmd = StoreCmd;
-    req.numArgs = 1;
-    req.args[0] = word;
-    send(dest, 1, &req);
-    addrReg = addr + 4;
+    run.numArgs = n;
+    send(dest, 1 + (n >> 2), &run);
+    addrReg = addr + 4*n;
   }
+  pthread_mutex_unlock(&sendLock);
 }
 
 // Start given number of threads on given core
@@ -546,6 +904,8 @@ void HostLink::startOne(uint32_t meshX, uint32_t meshY,
   uint32_t dest = toAddr(meshX, meshY, coreId, 0);
 
   // Send start command
+  pthread_mutex_lock(&sendLock);
+  pthread_mutex_lock(&recvLock);
   req.cmd = StartCmd;
   req.args[0] = numThreads-1;
   send(dest, 1, &req);
@@ -553,6 +913,8 @@ void HostLink::startOne(uint32_t meshX, uint32_t meshY,
   // Wait for start response
   uint32_t msg[1 << TinselLogWordsPerMsg];
   recv(msg);
+  pthread_mutex_unlock(&recvLock);
+  pthread_mutex_unlock(&sendLock);
 }
 
 // Start all threads on all cores
@@ -565,7 +927,11 @@ void HostLink::startAll()
   const uint32_t numCores =
     (meshXLen*meshYLen) << TinselLogCoresPerBoard;
 
-  // Send start command
+  // Send start command, buffered, draining responses as we go
+  pthread_mutex_lock(&sendLock);
+  pthread_mutex_lock(&recvLock);
+  bool buffered = useSendBuffer;
+  useSendBuffer = true;
   uint32_t started = 0;
   uint32_t msg[1 << TinselLogWordsPerMsg];
   for (int x = 0; x < meshXLen; x++) {
@@ -585,19 +951,30 @@ void HostLink::startAll()
       }
     }
   }
+  while (! tryFlush()) {
+    if (canRecv()) {
+      recv(msg);
+      started++;
+    }
+  }
+  useSendBuffer = buffered;
 
   // Wait for all start responses
   while (started < numCores) {
     recv(msg);
     started++;
   }
+  pthread_mutex_unlock(&recvLock);
+  pthread_mutex_unlock(&sendLock);
 }
 
 // Trigger application execution on all started threads on given core
 void HostLink::goOne(uint32_t meshX, uint32_t meshY, uint32_t coreId)
 {
+  pthread_mutex_lock(&debugLock);
   debugLink->setDest(meshX, meshY, coreId, 0);
   debugLink->put(meshX, meshY, 0);
+  pthread_mutex_unlock(&debugLock);
 }
 
 // Set address for remote memory access on given board via given core
@@ -618,14 +995,28 @@ void HostLink::store(uint32_t meshX, uint32_t meshY,
 {
   BootReq req;
   req.cmd = StoreCmd;
+  pthread_mutex_lock(&sendLock);
   while (numWords > 0) {
     uint32_t sendWords = numWords > 15 ? 15 : numWords;
     numWords = numWords - sendWords;
     req.numArgs = sendWords;
     for (uint32_t i = 0; i < sendWords; i++) req.args[i] = data[i];
+    data += sendWords;
     uint32_t numFlits = 1 + (sendWords >> 2);
     send(toAddr(meshX, meshY, coreId, 0), numFlits, &req);
   }
+  pthread_mutex_unlock(&sendLock);
+}
+
+// Store zero words to remote memory on a given board via given core
+void HostLink::zero(uint32_t meshX, uint32_t meshY,
+                    uint32_t coreId, uint32_t numWords)
+{
+  BootReq req;
+  req.cmd = ZeroCmd;
+  req.numArgs = 1;
+  req.args[0] = numWords;
+  send(toAddr(meshX, meshY, coreId, 0), 1, &req);
 }
 
 // Power-on self test
@@ -701,6 +1092,7 @@ bool HostLink::powerOnSelfTest()
 bool HostLink::pollStdOut(FILE* outFile, uint32_t* lineCount)
 {
   bool got = false;
+  pthread_mutex_lock(&debugLock);
   while (debugLink->canGet()) {
     // Receive byte
     uint8_t byte;
@@ -722,6 +1114,7 @@ bool HostLink::pollStdOut(FILE* outFile, uint32_t* lineCount)
       lineBufferLen[x][y][c][t]++;
     }
   }
+  pthread_mutex_unlock(&debugLock);
   return got;
 }
 
@@ -762,3 +1155,44 @@ void HostLink::dumpStdOut()
 {
   dumpStdOut(stdout);
 }
+
+// Body of the StdOut poller thread
+void* HostLink::stdOutPoller(void* arg)
+{
+  HostLink* hostLink = (HostLink*) arg;
+  while (! __atomic_load_n(&hostLink->stdOutStop, __ATOMIC_ACQUIRE)) {
+    if (hostLink->pollStdOut(hostLink->stdOutFile))
+      fflush(hostLink->stdOutFile);
+    else
+      usleep(10000);
+  }
+  return NULL;
+}
+
+// Start a thread that redirects UART StdOut to given file
+void HostLink::startStdOutPoller(FILE* outFile)
+{
+  if (stdOutPolling) return;
+  stdOutFile = outFile;
+  stdOutStop = false;
+  if (pthread_create(&stdOutThread, NULL, stdOutPoller, this) != 0) {
+    fprintf(stderr, "Failed to create StdOut poller thread\n");
+    exit(EXIT_FAILURE);
+  }
+  stdOutPolling = true;
+}
+
+// Start a thread that redirects UART StdOut to stdout
+void HostLink::startStdOutPoller()
+{
+  startStdOutPoller(stdout);
+}
+
+// Stop the StdOut poller thread, if running
+void HostLink::stopStdOutPoller()
+{
+  if (! stdOutPolling) return;
+  __atomic_store_n(&stdOutStop, true, __ATOMIC_RELEASE);
+  pthread_join(stdOutThread, NULL);
+  stdOutPolling = false;
+}
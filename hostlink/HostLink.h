@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <pthread.h>
 #include <config.h>
 #include <DebugLink.h>
 
@@ -15,6 +16,13 @@
 // Connections to PCIeStream
 #define PCIESTREAM      "pciestream"
 #define PCIESTREAM_SIM  "tinsel.b-1.1"
+#define PCIESTREAM_RING "pciestream-ring"
+
+// Shared-memory ring (see PCIeRing.h)
+struct PCIeRing;
+
+// Batch of flits in the send buffer (see HostLink.cpp)
+struct HostLinkSendBatch;
 
 // HostLink parameters
 struct HostLinkParams {
@@ -23,6 +31,18 @@ struct HostLinkParams {
   bool useExtraSendSlot;
 };
 
+// A batch of max-sized messages received in place (see recvBatch)
+template <typename T> struct HostLinkBatch {
+  // Number of messages in batch
+  uint32_t numMsgs;
+  // First message (messages are 1 << TinselLogBytesPerMsg bytes apart)
+  uint8_t* base;
+  // Access message i
+  T& operator[](uint32_t i) {
+    return *(T*) &base[i << TinselLogBytesPerMsg];
+  }
+};
+
 class HostLink {
   // Lock file for acquring exclusive access to PCIeStream
   int lockFile;
@@ -30,6 +50,10 @@ class HostLink {
   // File descriptor for link to PCIeStream
   int pcieLink;
 
+  // Shared-memory rings to and from PCIeStream
+  // (NULL if data is sent over pcieLink instead)
+  PCIeRing* pcieRings;
+
   // Line buffers for JTAG UART StdOut
   // Max line length defined by MaxLineLen
   // Indexed by (board X, board Y, core, thread)
@@ -37,8 +61,30 @@ class HostLink {
   int**** lineBufferLen;
 
   // Send buffer, for bulk sending over PCIe
-  char* sendBuffer;
-  int sendBufferLen;
+  // (A queue of batches, the newest of which is being filled)
+  HostLinkSendBatch* sendBatches;
+  int sendFirst;
+  int sendNumBatches;
+
+  // Receive buffer, for bulk receiving over PCIe
+  // (Bytes from recvStart up to recvEnd are yet to be consumed)
+  char* recvBuffer;
+  int recvStart;
+  int recvEnd;
+
+  // Locks for the send channel, the receive channel, and DebugLink
+  // (Recursive; when more than one is held, they are acquired in
+  // that order)
+  pthread_mutex_t sendLock;
+  pthread_mutex_t recvLock;
+  pthread_mutex_t debugLock;
+
+  // StdOut poller thread, and the file it writes to
+  pthread_t stdOutThread;
+  bool stdOutPolling;
+  bool stdOutStop;
+  FILE* stdOutFile;
+  static void* stdOutPoller(void* hostLink);
 
   // Request an extra send slot when bringing up Tinsel FPGAs
   bool useExtraSendSlot;
@@ -46,6 +92,20 @@ class HostLink {
   // Internal constructor
   void constructor(HostLinkParams params);
 
+  // Transfer bytes to and from PCIeStream
+  void pcieBlockingPut(char* buf, int numBytes);
+  bool pciePut(char* buf, int numBytes);
+  int pcieRead(char* buf, int maxBytes);
+  void pcieBlockingGet(char* buf, int numBytes);
+  bool pcieCanGet();
+  void pcieWaitPut();
+
+  // Block until receive buffer holds at least numBytes
+  void recvFill(int numBytes);
+
+  // Find room for numBytes at the end of the send buffer
+  char* sendReserve(int numBytes, bool block);
+
   // Internal helper for sending messages
   bool sendHelper(uint32_t dest, uint32_t numFlits, void* payload,
          bool block, uint32_t key);
@@ -73,6 +133,11 @@ class HostLink {
 
   // Send and receive messages over PCIe
   // -----------------------------------
+  //
+  // Sending and receiving are independent channels: one thread may
+  // send (including flush, tryFlush and pendingBytes) while another
+  // receives.  Calls on the same channel from several threads are
+  // serialised.
 
   // Send a message (blocking by default)
   bool send(uint32_t dest, uint32_t numFlits, void* msg, bool block = true);
@@ -104,14 +169,41 @@ class HostLink {
   // Receive multiple messages (blocking), given size of each message
   void recvMsgs(int numMsgs, int msgSize, void* msgs);
 
+  // Receive up to maxMsgs max-sized messages in place (blocking until
+  // there is at least one), returning the number received and setting
+  // msgs to point to the first.  Messages are 1 << TinselLogBytesPerMsg
+  // bytes apart, and remain valid until recvBatchDone is called.
+  // (Until then, the receive lock is held, so the calling thread must
+  // make no other receive, and other threads' receives wait.)
+  uint32_t recvBatch(uint32_t maxMsgs, void** msgs);
+
+  // Finish with the batch returned by recvBatch
+  void recvBatchDone();
+
+  // Typed version of the above
+  template <typename T> HostLinkBatch<T> recvBatch(uint32_t maxMsgs) {
+    HostLinkBatch<T> batch;
+    void* msgs;
+    batch.numMsgs = recvBatch(maxMsgs, &msgs);
+    batch.base = (uint8_t*) msgs;
+    return batch;
+  }
+
   // When enabled, use buffer for sending messages, permitting bulk writes
   // The buffer must be flushed to ensure data is sent
-  // Currently, only blocking sends are supported in this mode
+  // In this mode, trySend fails only when the buffer is full
   bool useSendBuffer;
 
   // Flush the send buffer (when send buffering is enabled)
   void flush();
 
+  // Write as much of the send buffer as possible without blocking,
+  // returning true if it is now empty
+  bool tryFlush();
+
+  // Number of bytes in the send buffer yet to be written
+  uint32_t pendingBytes();
+
   // Address construction/deconstruction
   // -----------------------------------
 
@@ -143,6 +235,10 @@ class HostLink {
   void store(uint32_t meshX, uint32_t meshY,
              uint32_t coreId, uint32_t numWords, uint32_t* data);
 
+  // Store zero words to remote memory on given board via given core
+  void zero(uint32_t meshX, uint32_t meshY,
+            uint32_t coreId, uint32_t numWords);
+
   // Finer-grained control over application loading and execution
   // ------------------------------------------------------------
 
@@ -186,6 +282,15 @@ class HostLink {
 
   // Receive StdOut byte streams and display on stdout (non-terminating)
   void dumpStdOut();
+
+  // Start a thread that appends StdOut byte streams to file
+  void startStdOutPoller(FILE* outFile);
+
+  // Start a thread that displays StdOut byte streams on stdout
+  void startStdOutPoller();
+
+  // Stop the StdOut poller thread, if running
+  void stopStdOutPoller();
 };
 
 #endif
@@ -6,41 +6,214 @@
 //   6F 00 40 00 13 01
 //
 //   @00100000
-//   48 65 6C 6C 6F 20 66 72 6F 6D 20 74 68 72 65 61 
-//   64 20 30 78 25 78 0A 00 
+//   48 65 6C 6C 6F 20 66 72 6F 6D 20 74 68 72 65 61
+//   64 20 30 78 25 78 0A 00
 //
 // The @ sign denotes a start address.  The hex bytes that follow it,
 // up to the next @ sign, are a contiguous stream of bytes starting
 // at that address.
+//
+// A file is parsed once into a list of segments held in memory, and
+// kept for reuse by later readers of the same file, e.g. when an
+// application boots several times.  The parsed image is discarded if
+// the file's modification time or size changes.  Images are reference
+// counted, so a discarded image stays valid until its last reader is
+// destroyed, and the cache is protected by a lock, so readers may be
+// created on several threads.
 
 #include "MemFileReader.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+struct MemImage {
+  // File the image was parsed from
+  char* filename;
+  struct timespec mtime;
+  off_t size;
+
+  // Segments
+  MemSegment* segments;
+  uint32_t numSegments;
+  uint32_t maxSegments;
+
+  // Bytes of all segments
+  uint8_t* data;
+  uint32_t numBytes;
+  uint32_t maxBytes;
+
+  // Number of readers using the image, plus one while it is cached
+  uint32_t refCount;
+
+  // Next image in cache
+  MemImage* next;
+};
+
+// Images parsed so far
+static MemImage* imageCache = NULL;
+
+// Lock protecting the cache and the reference counts
+static pthread_mutex_t imageCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Drop a reference to an image, freeing it if there are none left
+// (Caller must hold imageCacheLock)
+static void releaseImage(MemImage* image)
+{
+  assert(image->refCount > 0);
+  if (--image->refCount > 0) return;
+  free(image->filename);
+  free(image->segments);
+  free(image->data);
+  free(image);
+}
+
+// Value of given hex digit, or -1 if it is not a hex digit
+static inline int hexDigit(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Append a byte to the image data
+static inline void appendByte(MemImage* image, uint8_t byte)
+{
+  if (image->numBytes == image->maxBytes) {
+    image->maxBytes = image->maxBytes == 0 ? 4096 : 2*image->maxBytes;
+    image->data = (uint8_t*) realloc(image->data, image->maxBytes);
+    if (image->data == NULL) {
+      fprintf(stderr, "MemFileReader: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  image->data[image->numBytes++] = byte;
+}
+
+// Start a new segment at given address
+static void startSegment(MemImage* image, uint32_t addr)
+{
+  // Continue the current segment if contiguous
+  if (image->numSegments > 0) {
+    MemSegment* s = &image->segments[image->numSegments-1];
+    if (s->addr + s->numBytes == addr) return;
+  }
+  // Pad data of current segment to a word boundary
+  while (image->numBytes & 3) appendByte(image, 0);
+  if (image->numSegments == image->maxSegments) {
+    image->maxSegments = image->maxSegments == 0 ? 16 : 2*image->maxSegments;
+    image->segments = (MemSegment*)
+      realloc(image->segments, image->maxSegments * sizeof(MemSegment));
+    if (image->segments == NULL) {
+      fprintf(stderr, "MemFileReader: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  MemSegment* s = &image->segments[image->numSegments++];
+  s->addr = addr;
+  s->numBytes = 0;
+  s->offset = image->numBytes;
+}
+
+// Parse given file
+static MemImage* parseImage(const char* filename, struct stat* st)
+{
+  // Read whole file
+  FILE* fp = fopen(filename, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to open file '%s'\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  char* text = (char*) malloc(st->st_size + 1);
+  if (text == NULL ||
+        fread(text, 1, st->st_size, fp) != (size_t) st->st_size) {
+    fprintf(stderr, "Failed to read file '%s'\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  text[st->st_size] = '\0';
+  fclose(fp);
+
+  // Parse it
+  MemImage* image = (MemImage*) calloc(1, sizeof(MemImage));
+  image->filename = strdup(filename);
+  image->mtime = st->st_mtim;
+  image->size = st->st_size;
+  for (char* p = text; *p != '\0'; ) {
+    if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+      p++;
+      continue;
+    }
+    bool isAddr = *p == '@';
+    if (isAddr) p++;
+    if (hexDigit(*p) < 0) {
+      fprintf(stderr, "Invalid memory file '%s'\n", filename);
+      exit(EXIT_FAILURE);
+    }
+    uint32_t value = 0;
+    for (int d; (d = hexDigit(*p)) >= 0; p++) value = (value << 4) | d;
+    if (isAddr)
+      startSegment(image, value);
+    else {
+      if (image->numSegments == 0) startSegment(image, 0);
+      appendByte(image, value);
+      image->segments[image->numSegments-1].numBytes++;
+    }
+  }
+  while (image->numBytes & 3) appendByte(image, 0);
+  free(text);
+  return image;
+}
 
 // Constructor
 MemFileReader::MemFileReader(const char* filename)
 {
-  address = 0;
-  fp = fopen(filename, "rt");
-  if (fp == NULL) {
+  struct stat st;
+  if (stat(filename, &st) != 0) {
     fprintf(stderr, "Failed to open file '%s'\n", filename);
     exit(EXIT_FAILURE);
   }
+  // Look for an up-to-date image in the cache
+  pthread_mutex_lock(&imageCacheLock);
+  MemImage** prev = &imageCache;
+  for (image = imageCache; image != NULL; image = image->next) {
+    if (strcmp(image->filename, filename) == 0) {
+      if (image->size == st.st_size &&
+            image->mtime.tv_sec == st.st_mtim.tv_sec &&
+            image->mtime.tv_nsec == st.st_mtim.tv_nsec) break;
+      // Out of date: remove from cache (other readers may still use it)
+      *prev = image->next;
+      releaseImage(image);
+      image = NULL;
+      break;
+    }
+    prev = &image->next;
+  }
+  if (image == NULL) {
+    image = parseImage(filename, &st);
+    image->refCount = 1;
+    image->next = imageCache;
+    imageCache = image;
+  }
+  image->refCount++;
+  pthread_mutex_unlock(&imageCacheLock);
+  seg = pos = 0;
 }
 
 // Read a byte
 bool MemFileReader::getByte(uint32_t* addr, uint8_t* byte)
 {
-  assert(fp != NULL);
-  uint32_t data;
-  *addr = address;
-  while (fscanf(fp, " @%x", &address) > 0) *addr = address;
-  if (fscanf(fp, " %x", &data) > 0) {
-    *byte = (uint8_t) data;
-    address++;
-    return true;
+  for (; seg < image->numSegments; seg++, pos = 0) {
+    MemSegment* s = &image->segments[seg];
+    if (pos < s->numBytes) {
+      *addr = s->addr + pos;
+      *byte = image->data[s->offset + pos];
+      pos++;
+      return true;
+    }
   }
   return false;
 }
@@ -48,27 +221,36 @@ bool MemFileReader::getByte(uint32_t* addr, uint8_t* byte)
 // Read a 32-bit word
 bool MemFileReader::getWord(uint32_t* addr, uint32_t* word)
 {
-  assert(fp != NULL);
-  *word = 0;
-  uint8_t* bytePtr = (uint8_t*) word;
-  uint32_t data;
-  *addr = address;
-  int count = 0;
-  while (fscanf(fp, " @%x", &address) > 0) *addr = address;
-  while (fscanf(fp, " %x", &data) > 0) {
-    bytePtr[count] = (uint8_t) data;
-    count++;
-    if (count == 4) break;
-  }
-  if (count != 0) {
-    address += 4;
-    return true;
+  return getRun(addr, word, 1) == 1;
+}
+
+// Read a run of up to maxWords 32-bit words at consecutive addresses
+// (A partial word at the end of a segment is padded with zeros)
+uint32_t MemFileReader::getRun(uint32_t* addr, uint32_t* words,
+                               uint32_t maxWords)
+{
+  for (; seg < image->numSegments; seg++, pos = 0) {
+    MemSegment* s = &image->segments[seg];
+    if (pos < s->numBytes) {
+      *addr = s->addr + pos;
+      uint32_t n = 0;
+      while (n < maxWords && pos < s->numBytes) {
+        uint32_t bytes = s->numBytes - pos < 4 ? s->numBytes - pos : 4;
+        words[n] = 0;
+        memcpy(&words[n], &image->data[s->offset + pos], bytes);
+        pos += bytes;
+        n++;
+      }
+      return n;
+    }
   }
-  return false;
+  return 0;
 }
 
 // Destructor
 MemFileReader::~MemFileReader()
 {
-  if (fp != NULL) fclose(fp);
+  pthread_mutex_lock(&imageCacheLock);
+  releaseImage(image);
+  pthread_mutex_unlock(&imageCacheLock);
 }
@@ -6,9 +6,31 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+// A contiguous run of bytes in a memory image
+struct MemSegment {
+  // Start address
+  uint32_t addr;
+  // Number of bytes
+  uint32_t numBytes;
+  // Offset of bytes in image data (padded with zeros to a word boundary)
+  uint32_t offset;
+};
+
+// A memory image, parsed once from a file and cached thereafter
+// (until the file's modification time or size changes), and shared
+// between readers, which may be on different threads
+struct MemImage;
+
 class MemFileReader {
-  FILE* fp;
-  uint32_t address;
+  MemImage* image;
+
+  // Current segment, and offset of next byte within it
+  uint32_t seg;
+  uint32_t pos;
+
+  // Readers hold a reference to the image, so are not copyable
+  MemFileReader(const MemFileReader&);
+  MemFileReader& operator=(const MemFileReader&);
 
  public:
   // Constructor
@@ -20,6 +42,10 @@ class MemFileReader {
   // Read a 32-bit word
   bool getWord(uint32_t* addr, uint32_t* word);
 
+  // Read a run of up to maxWords 32-bit words at consecutive addresses
+  // Returns the number of words read (zero at end of file)
+  uint32_t getRun(uint32_t* addr, uint32_t* words, uint32_t maxWords);
+
   // Destructor
   ~MemFileReader();
 };
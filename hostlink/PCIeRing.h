@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#ifndef _PCIERING_H_
+#define _PCIERING_H_
+
+// Shared-memory rings between HostLink and pciestreamd
+// ====================================================
+//
+// As an alternative to streaming flits over the pciestreamd socket, a
+// client can connect to the PCIESTREAM_RING socket.  The daemon then
+// creates a memfd holding two single-producer/single-consumer byte
+// rings (host-to-FPGA and FPGA-to-host), along with two eventfd
+// doorbells per ring, and passes them to the client over the socket.
+// Flits are exchanged through the rings; the socket is only used to
+// detect when either side goes away.
+//
+// A doorbell is only rung when the other side has said that it is
+// about to sleep, so while both sides are busy no system calls are
+// made at all.
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+// Size of each ring's data region in bytes (a power of two)
+#define PCIeRingBytes (1 << 22)
+
+// Size of each ring's control region in bytes
+#define PCIeRingCtrlBytes 4096
+
+// Ring indices
+#define PCIeRingToFPGA   0
+#define PCIeRingFromFPGA 1
+
+// Control block, at the start of each ring's shared region
+struct PCIeRingCtrl {
+  // Total bytes written by producer
+  volatile uint64_t head __attribute__((aligned(64)));
+  // Is the consumer about to wait on the data doorbell?
+  volatile uint32_t consumerWaiting;
+  // Total bytes read by consumer
+  volatile uint64_t tail __attribute__((aligned(64)));
+  // Is the producer about to wait on the space doorbell?
+  volatile uint32_t producerWaiting;
+};
+
+// One end of a ring
+struct PCIeRing {
+  PCIeRingCtrl* ctrl;
+  char* data;
+  // Rung by producer when data is added
+  int dataBell;
+  // Rung by consumer when space is freed
+  int spaceBell;
+};
+
+// Number of bytes available to the consumer
+inline uint32_t ringAvailable(PCIeRing* r)
+{
+  return __atomic_load_n(&r->ctrl->head, __ATOMIC_ACQUIRE) - r->ctrl->tail;
+}
+
+// Number of bytes of space available to the producer
+inline uint32_t ringSpace(PCIeRing* r)
+{
+  return PCIeRingBytes -
+    (r->ctrl->head - __atomic_load_n(&r->ctrl->tail, __ATOMIC_ACQUIRE));
+}
+
+// Ring doorbell if other side is waiting on it
+inline void ringNotify(volatile uint32_t* waiting, int bell)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (*waiting) {
+    uint64_t one = 1;
+    if (write(bell, &one, sizeof(one)) < 0) return;
+  }
+}
+
+// Write up to n bytes to ring, returning number of bytes written
+inline int ringPut(PCIeRing* r, const char* buf, int n)
+{
+  uint32_t space = ringSpace(r);
+  if ((uint32_t) n > space) n = space;
+  if (n == 0) return 0;
+  uint32_t pos = r->ctrl->head & (PCIeRingBytes-1);
+  uint32_t first = PCIeRingBytes - pos;
+  if (first > (uint32_t) n) first = n;
+  memcpy(&r->data[pos], buf, first);
+  memcpy(r->data, &buf[first], n - first);
+  __atomic_store_n(&r->ctrl->head, r->ctrl->head + n, __ATOMIC_RELEASE);
+  ringNotify(&r->ctrl->consumerWaiting, r->dataBell);
+  return n;
+}
+
+// Read up to n bytes from ring, returning number of bytes read
+inline int ringGet(PCIeRing* r, char* buf, int n)
+{
+  uint32_t avail = ringAvailable(r);
+  if ((uint32_t) n > avail) n = avail;
+  if (n == 0) return 0;
+  uint32_t pos = r->ctrl->tail & (PCIeRingBytes-1);
+  uint32_t first = PCIeRingBytes - pos;
+  if (first > (uint32_t) n) first = n;
+  memcpy(buf, &r->data[pos], first);
+  memcpy(&buf[first], r->data, n - first);
+  __atomic_store_n(&r->ctrl->tail, r->ctrl->tail + n, __ATOMIC_RELEASE);
+  ringNotify(&r->ctrl->producerWaiting, r->spaceBell);
+  return n;
+}
+
+// Block until given condition may hold, or given socket is closed by
+// the other side (in which case, return false)
+inline bool ringWait(PCIeRing* r, bool forData, int sock)
+{
+  volatile uint32_t* waiting = forData ?
+    &r->ctrl->consumerWaiting : &r->ctrl->producerWaiting;
+  int bell = forData ? r->dataBell : r->spaceBell;
+  bool ok = true;
+  *waiting = 1;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if ((forData ? ringAvailable(r) : ringSpace(r)) == 0) {
+    struct pollfd fds[2];
+    fds[0].fd = bell; fds[0].events = POLLIN;
+    fds[1].fd = sock; fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) < 0) ok = false;
+    if (fds[0].revents & POLLIN) {
+      uint64_t count;
+      if (read(bell, &count, sizeof(count)) < 0) ok = false;
+    }
+    // The peer never sends on the socket, so readable means closed
+    if (fds[1].revents) ok = false;
+  }
+  *waiting = 0;
+  return ok;
+}
+
+// Map the rings held in given memfd, with given doorbells
+// (Doorbells are in the order: data and space for ring 0, then ring 1)
+inline bool ringMap(int memFd, int* bells, PCIeRing* rings)
+{
+  const size_t ringRegion = PCIeRingCtrlBytes + PCIeRingBytes;
+  void* ptr = mmap(NULL, 2*ringRegion, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, memFd, 0);
+  if (ptr == MAP_FAILED) return false;
+  for (int i = 0; i < 2; i++) {
+    char* base = (char*) ptr + i*ringRegion;
+    rings[i].ctrl = (PCIeRingCtrl*) base;
+    rings[i].data = base + PCIeRingCtrlBytes;
+    rings[i].dataBell = bells[2*i];
+    rings[i].spaceBell = bells[2*i+1];
+  }
+  return true;
+}
+
+// Unmap rings and close their file descriptors
+inline void ringUnmap(PCIeRing* rings)
+{
+  munmap(rings[0].ctrl, 2*(PCIeRingCtrlBytes + PCIeRingBytes));
+  for (int i = 0; i < 2; i++) {
+    close(rings[i].dataBell);
+    close(rings[i].spaceBell);
+  }
+}
+
+// Create rings, and send them to the client on the given socket
+// (Called by pciestreamd; returns false on failure)
+inline bool ringCreate(int sock, PCIeRing* rings)
+{
+  int fds[5];
+  fds[0] = memfd_create("pciestream-rings", MFD_CLOEXEC);
+  if (fds[0] == -1) return false;
+  if (ftruncate(fds[0], 2*(PCIeRingCtrlBytes + PCIeRingBytes)) != 0) {
+    close(fds[0]);
+    return false;
+  }
+  for (int i = 1; i < 5; i++) fds[i] = eventfd(0, EFD_CLOEXEC);
+  bool ok = fds[1] != -1 && fds[2] != -1 && fds[3] != -1 && fds[4] != -1 &&
+              ringMap(fds[0], &fds[1], rings);
+  if (ok) {
+    // Send file descriptors
+    char byte = 0;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    union {
+      char buf[CMSG_SPACE(sizeof(fds))];
+      struct cmsghdr align;
+    } ctrl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    ok = sendmsg(sock, &msg, 0) == 1;
+    if (!ok) ringUnmap(rings);
+  }
+  else {
+    for (int i = 1; i < 5; i++) if (fds[i] != -1) close(fds[i]);
+  }
+  close(fds[0]);
+  return ok;
+}
+
+// Receive rings from pciestreamd on the given socket
+// (Called by HostLink; returns false on failure)
+inline bool ringReceive(int sock, PCIeRing* rings)
+{
+  int fds[5];
+  char byte;
+  struct iovec iov;
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } ctrl;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl.buf;
+  msg.msg_controllen = sizeof(ctrl.buf);
+  if (recvmsg(sock, &msg, 0) != 1) return false;
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) return false;
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  bool ok = ringMap(fds[0], &fds[1], rings);
+  close(fds[0]);
+  return ok;
+}
+
+#endif
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#ifndef _PCIESESSION_H_
+#define _PCIESESSION_H_
+
+// Sessions with pciestreamd
+// =========================
+//
+// Several clients may use pciestreamd at the same time, provided each
+// one owns a disjoint sub-mesh of boards.  After connecting, a client
+// sends a PCIeSessionReq describing its sub-mesh, and the daemon
+// replies with a single PCIeSessionReply byte.  Messages from a client
+// may only be addressed to threads in its sub-mesh, or to routing keys
+// looked up by boards in its sub-mesh.  Tagged clients may not address
+// the bridge boards (via the host bit).  A command may carry at most
+// MaxMsgsPerCommand messages (see pciestreamd.cpp), and must be sent
+// without stalling, as no other client is served until it is complete.
+//
+// Messages arriving at the host carry no source address, so the daemon
+// can only share the host link between clients whose threads put their
+// own thread id (tinselId()) in the first word of every message sent to
+// the host.  Such clients set the PCIeSessionTagged flag; messages are
+// then delivered to the client owning the board of that thread.  An
+// untagged client must have the daemon to itself, and receives all
+// messages.
+//
+// HostLink always claims the whole mesh, untagged: it also needs the
+// box's boardctrld, which serves one DebugLink connection at a time.
+
+#include <stdint.h>
+
+// Value of magic field
+#define PCIeSessionMagic 0x50435345
+
+// Flags
+#define PCIeSessionTagged 1
+
+// Session request
+struct PCIeSessionReq {
+  uint32_t magic;
+  // Sub-mesh of boards: origin and dimensions
+  uint32_t x, y, xLen, yLen;
+  // Flags
+  uint32_t flags;
+};
+
+// Reply from daemon
+enum PCIeSessionReply {
+  PCIeSessionOK = 0,
+  // Sub-mesh overlaps another session, or other sessions are untagged
+  PCIeSessionBusy = 1,
+  // Malformed request
+  PCIeSessionInvalid = 2
+};
+
+#endif
@@ -4,15 +4,39 @@
 // PCIeStream Daemon
 // =================
 //
-// Connect UNIX domain socket to FPGA FIFO via PCIeStream.
+// Connect UNIX domain sockets to FPGA FIFO via PCIeStream.
+//
+// Clients connecting to the SOCKET_NAME socket stream flits over the
+// socket itself.  Clients connecting to the RING_SOCKET_NAME socket
+// are instead given a pair of shared-memory rings (see PCIeRing.h),
+// and the socket is only used to detect when the client goes away.
+//
+// Several clients can be served at once, each owning a disjoint
+// sub-mesh of boards (see PCIeSession.h).  Their commands are
+// interleaved in the stream to the FPGA, and messages from the FPGA
+// are delivered to the client owning the sending thread.
+//
+// When run with the -l option, a loopback device stands in for the
+// FPGA (see below), allowing the daemon and its clients to be tested
+// without hardware.
+//
+// When idle, the daemon spins for a while before sleeping for
+// exponentially increasing periods (see "Event loop" below).  Counters
+// can be read from the STATS_SOCKET_NAME socket, e.g. using
+// "udsock out @pciestream-stats".
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
 #include <sys/un.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
@@ -21,6 +45,11 @@
 #include <assert.h>
 #include <poll.h>
 #include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <config.h>
+#include "PCIeRing.h"
+#include "PCIeSession.h"
 
 // Constants
 // ---------
@@ -28,12 +57,45 @@
 // Default socket location
 #define SOCKET_NAME "pciestream"
 
+// Socket location for clients using shared-memory rings
+#define RING_SOCKET_NAME "pciestream-ring"
+
+// Socket location for reading counters
+#define STATS_SOCKET_NAME "pciestream-stats"
+
 // Size of each DMA buffer in bytes
 #define DMABufferSize 1048576
 
 // Number of bytes per cache line
 #define CacheLineBytes 64
 
+// Bytes per message received by host
+#define MsgBytes (1 << TinselLogBytesPerMsg)
+
+// Maximum number of concurrent clients
+#define MaxClients 64
+
+// Maximum number of connections waiting to send a session request,
+// and time allowed for the request to arrive, in nanoseconds
+#define MaxPending 64
+#define PendingTimeoutNs 1000000000
+
+// Size of each client's buffer of data on its way to the FPGA
+#define StageBytes 65536
+
+// Maximum number of messages in one command from a client, and time
+// allowed for a client to supply the rest of a command it has started,
+// in nanoseconds (other clients can't be served meanwhile)
+#define MaxMsgsPerCommand 1024
+#define CommandTimeoutNs 1000000000
+
+// Size of each socket client's queue of data on its way from the FPGA
+#define QueueBytes 1048576
+
+// Shortest and default longest sleep when idle, in nanoseconds
+#define MinSleepNs 1000
+#define DefaultMaxSleepNs 1000000
+
 // PCIeStream CSRs
 #define CSR_ADDR_RX_A 0
 #define CSR_ADDR_RX_B 1
@@ -74,11 +136,12 @@ void swap(volatile char** p, volatile char** q)
   volatile char* tmp = *p; *p = *q; *q = tmp;
 }
 
-// Check if connection is alive
-int alive(int sock)
+// Current time in nanoseconds
+inline uint64_t nowNs()
 {
-  char buf;
-  return send(sock, &buf, 0, 0) == 0;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 // Types
@@ -86,14 +149,52 @@ int alive(int sock)
 
 // Return value of transmitter or receiver step function
 typedef enum {
-  CLOSED,      // Client has closed the connection
   FULL,        // Transmit buffer is full
   EMPTY,       // Receive buffer is empty
-  NO_SEND,     // Nothing to send from client
+  NO_SEND,     // Nothing to send from clients
   CLIENT_BUSY, // Client can't currently receive more data
   PROGRESS     // Progress was made
 } Status;
 
+// Client state
+typedef struct {
+  // Connection (socket)
+  int sock;
+  // Does client use shared-memory rings for data?
+  int useRings;
+  PCIeRing rings[2];
+  // Session request, including sub-mesh owned by client
+  PCIeSessionReq req;
+  // Is data available on the socket?
+  int canRead;
+  // Is delivery to the client waiting for space in its ring?
+  int rxBlocked;
+  // Has the client gone away (or misbehaved)?
+  int closed;
+  // Data read from client but not yet written to the DMA buffer
+  char* stage;
+  int stageStart, stageEnd;
+  // Header of the current command, and number of bytes of it received
+  uint32_t header[4];
+  int headerBytes;
+  // Payload bytes of the current command not yet written to DMA buffer
+  uint64_t payloadLeft;
+  // Data waiting to be written to the socket (when not using rings)
+  char* queue;
+  int queueStart, queueEnd;
+} Client;
+
+// Connection whose session request has not yet arrived
+typedef struct {
+  int sock;
+  int useRings;
+  // Time of connection
+  uint64_t acceptNs;
+  // Session request, and number of bytes of it received
+  PCIeSessionReq req;
+  int reqBytes;
+} Pending;
+
 // Transmitter state
 typedef struct {
   // Access to control/status registers on FPGA side
@@ -102,14 +203,20 @@ typedef struct {
   volatile char* txA;
   // Transmit buffer B
   volatile char* txB;
-  // Client connection (socket)
-  int client;
   // Which buffer in the double buffer is currently being written to?
   int activeBuffer;
   // Is the active buffer ready to be filled?
   int bufferReady;
   // The number of bytes written to the active buffer but not yet sent
   int pending;
+  // Client whose current command is partly written to the DMA buffers,
+  // and time at which it last supplied part of it
+  Client* owner;
+  uint64_t ownerNs;
+  // Zero bytes still to write in place of a departed owner's command
+  uint64_t padding;
+  // Index of next client to serve
+  int next;
 } TxState;
 
 // Receiver state
@@ -120,76 +227,403 @@ typedef struct {
   volatile char* rxA;
   // Receive buffer B
   volatile char* rxB;
-  // Client connection (socket)
-  int client;
   // Which buffer in the double buffer is currently being read from?
   int activeBuffer;
-  // Number of bytes written to the client
-  int written;
+  // Number of bytes delivered to clients (or dropped)
+  int consumed;
   // The number of bytes in the DMA buffer available for reading
   int available;
+  // Destination of the current message (NULL to drop it)
+  Client* dest;
+  // Number of bytes of the current message consumed
+  int msgBytes;
 } RxState;
 
+// Counters
+typedef struct {
+  // Time of startup, and of last report
+  uint64_t startNs, reportNs;
+  // Bytes sent to and received from the FPGA, in total and at last report
+  uint64_t toFPGABytes, fromFPGABytes;
+  uint64_t reportToFPGABytes, reportFromFPGABytes;
+  // DMA buffers sent to and received from the FPGA
+  uint64_t toFPGABuffers, fromFPGABuffers;
+  // Bytes from the FPGA with no client to receive them
+  uint64_t droppedBytes;
+  // Number of sleeps, and of those ended by a ring client's doorbell
+  uint64_t sleeps, doorbells;
+} Stats;
+
+// Clients
+// -------
+
+// Connected clients
+Client* clients[MaxClients];
+int numClients = 0;
+
+// Connections awaiting a session request
+Pending pending[MaxPending];
+int numPending = 0;
+
+// Owner of each board
+Client* boardOwner[1 << TinselMeshYBits][1 << TinselMeshXBits];
+
+// Counters
+Stats stats;
+
+// Determine board containing given thread
+inline void threadBoard(uint32_t id, uint32_t* x, uint32_t* y)
+{
+  *x = (id >> TinselLogThreadsPerBoard) & ((1 << TinselMeshXBits) - 1);
+  *y = (id >> (TinselLogThreadsPerBoard + TinselMeshXBits)) &
+         ((1 << TinselMeshYBits) - 1);
+}
+
+// Can client send to given destination address?
+int mayAddress(Client* c, uint32_t dest)
+{
+  // Above the board id are the host option (valid and value bits), the
+  // routing key bit, and the accelerator bit (see NetAddr in Globals.bsv)
+  uint32_t upper =
+    dest >> (TinselLogThreadsPerBoard + TinselMeshXBits + TinselMeshYBits);
+  // A message routed to a bridge board could reach any session
+  if ((upper & 3) && (c->req.flags & PCIeSessionTagged)) return 0;
+  // Otherwise, the board id gives the board that receives the message
+  // (or, for a routing key, the board whose router looks the key up)
+  uint32_t x, y;
+  threadBoard(dest, &x, &y);
+  return x - c->req.x < c->req.xLen && y - c->req.y < c->req.yLen;
+}
+
+// Decide whether to accept given session request
+PCIeSessionReply admit(PCIeSessionReq* req)
+{
+  if (req->magic != PCIeSessionMagic ||
+        req->x >= (1 << TinselMeshXBits) ||
+        req->y >= (1 << TinselMeshYBits) ||
+        req->xLen == 0 || req->xLen > (1 << TinselMeshXBits) - req->x ||
+        req->yLen == 0 || req->yLen > (1 << TinselMeshYBits) - req->y)
+    return PCIeSessionInvalid;
+  if (numClients == MaxClients) return PCIeSessionBusy;
+  // Untagged clients can't share the daemon
+  for (int i = 0; i < numClients; i++)
+    if (!(req->flags & PCIeSessionTagged) ||
+          !(clients[i]->req.flags & PCIeSessionTagged))
+      return PCIeSessionBusy;
+  // Sub-meshes must be disjoint
+  for (uint32_t y = req->y; y < req->y + req->yLen; y++)
+    for (uint32_t x = req->x; x < req->x + req->xLen; x++)
+      if (boardOwner[y][x]) return PCIeSessionBusy;
+  return PCIeSessionOK;
+}
+
+// Accept a connection on given listener
+// (The session request is read later, when it arrives)
+void acceptClient(int listener, int useRings, int epoll)
+{
+  int sock = accept(listener, NULL, NULL);
+  if (sock == -1) {
+    perror("pciestreamd: accept");
+    return;
+  }
+  if (numPending == MaxPending) {
+    close(sock);
+    return;
+  }
+  Pending* p = &pending[numPending++];
+  p->sock = sock;
+  p->useRings = useRings;
+  p->acceptNs = nowNs();
+  p->reqBytes = 0;
+
+  // Wait for data or hang-up on socket
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.fd = sock;
+  epoll_ctl(epoll, EPOLL_CTL_ADD, sock, &ev);
+}
+
+// Create client from a connection whose session request was admitted
+// (The socket is already registered with epoll)
+void openClient(Pending* p, int epoll)
+{
+  int sock = p->sock;
+  Client* c = (Client*) calloc(1, sizeof(Client));
+  c->sock = sock;
+  c->useRings = p->useRings;
+  c->req = p->req;
+  if (c->useRings && !ringCreate(sock, c->rings)) {
+    perror("pciestreamd: ringCreate");
+    epoll_ctl(epoll, EPOLL_CTL_DEL, sock, NULL);
+    close(sock);
+    free(c);
+    return;
+  }
+  c->stage = (char*) malloc(StageBytes);
+  if (!c->useRings) c->queue = (char*) malloc(QueueBytes);
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+  // Wait for doorbells from ring client while sleeping: data to send,
+  // and space to receive
+  if (c->useRings) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = c->rings[PCIeRingToFPGA].dataBell;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, ev.data.fd, &ev);
+    ev.data.fd = c->rings[PCIeRingFromFPGA].spaceBell;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, ev.data.fd, &ev);
+  }
+
+  // Claim boards
+  for (uint32_t y = c->req.y; y < c->req.y + c->req.yLen; y++)
+    for (uint32_t x = c->req.x; x < c->req.x + c->req.xLen; x++)
+      boardOwner[y][x] = c;
+  clients[numClients++] = c;
+}
+
+// Remove pending connection i, closing its socket unless it has become
+// a client
+void closePending(int i, int epoll, int keepSocket)
+{
+  if (! keepSocket) {
+    epoll_ctl(epoll, EPOLL_CTL_DEL, pending[i].sock, NULL);
+    close(pending[i].sock);
+  }
+  pending[i] = pending[--numPending];
+}
+
+// Read the session request of pending connection i, replying and
+// opening a client once it is complete
+void readRequest(int i, int epoll)
+{
+  Pending* p = &pending[i];
+  int n = recv(p->sock, (char*) &p->req + p->reqBytes,
+                 sizeof(PCIeSessionReq) - p->reqBytes, MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+  if (n <= 0) {
+    closePending(i, epoll, 0);
+    return;
+  }
+  p->reqBytes += n;
+  if (p->reqBytes < (int) sizeof(PCIeSessionReq)) return;
+  uint8_t reply = admit(&p->req);
+  if (send(p->sock, &reply, 1, MSG_DONTWAIT) != 1 || reply != PCIeSessionOK) {
+    closePending(i, epoll, 0);
+    return;
+  }
+  openClient(p, epoll);
+  closePending(i, epoll, 1);
+}
+
+// Drop pending connections that haven't sent a request in time
+void expirePending(int epoll)
+{
+  uint64_t now = nowNs();
+  for (int i = 0; i < numPending; ) {
+    if (now - pending[i].acceptNs > PendingTimeoutNs)
+      closePending(i, epoll, 0);
+    else
+      i++;
+  }
+}
+
+// Find pending connection with given socket (-1 if none)
+int findPending(int fd)
+{
+  for (int i = 0; i < numPending; i++)
+    if (pending[i].sock == fd) return i;
+  return -1;
+}
+
+// Find client with given socket or doorbell
+Client* findClient(int fd)
+{
+  for (int i = 0; i < numClients; i++) {
+    Client* c = clients[i];
+    if (c->sock == fd) return c;
+    if (c->useRings && (c->rings[PCIeRingToFPGA].dataBell == fd ||
+          c->rings[PCIeRingFromFPGA].spaceBell == fd)) return c;
+  }
+  return NULL;
+}
+
+// Remove clients that have gone away
+void reapClients(TxState* tx, RxState* rx, int epoll)
+{
+  for (int i = 0; i < numClients; ) {
+    Client* c = clients[i];
+    if (! c->closed) { i++; continue; }
+    // The rest of a partly-sent command is replaced by zeros,
+    // keeping the stream to the FPGA in sync
+    if (tx->owner == c) {
+      tx->padding = c->payloadLeft;
+      tx->owner = NULL;
+    }
+    // The rest of a message being delivered is dropped
+    if (rx->dest == c) rx->dest = NULL;
+    for (uint32_t y = c->req.y; y < c->req.y + c->req.yLen; y++)
+      for (uint32_t x = c->req.x; x < c->req.x + c->req.xLen; x++)
+        boardOwner[y][x] = NULL;
+    // The client may still hold its doorbells, so deregister explicitly
+    if (c->useRings) {
+      int bell = c->rings[PCIeRingToFPGA].dataBell;
+      epoll_ctl(epoll, EPOLL_CTL_DEL, bell, NULL);
+      bell = c->rings[PCIeRingFromFPGA].spaceBell;
+      epoll_ctl(epoll, EPOLL_CTL_DEL, bell, NULL);
+      ringUnmap(c->rings);
+    }
+    epoll_ctl(epoll, EPOLL_CTL_DEL, c->sock, NULL);
+    close(c->sock);
+    free(c->stage);
+    free(c->queue);
+    free(c);
+    clients[i] = clients[--numClients];
+    if (tx->next >= numClients) tx->next = 0;
+  }
+}
+
 // Transmitter
 // -----------
 
 // Intialise the transmitter state
-void txInit(TxState* s, int client, volatile uint64_t* csrs,
+void txInit(TxState* s, volatile uint64_t* csrs,
        volatile char* txA, volatile char* txB)
 {
-  s->client = client;
   s->csrs = csrs;
   s->txA = txA;
   s->txB = txB;
   s->activeBuffer = 0;
   s->bufferReady = 0;
   s->pending = 0;
+  s->owner = NULL;
+  s->ownerNs = 0;
+  s->padding = 0;
+  s->next = 0;
+}
+
+// Read from client into its staging buffer, returning the number of
+// bytes staged
+int txStage(Client* c)
+{
+  if (c->stageStart < c->stageEnd) return c->stageEnd - c->stageStart;
+  c->stageStart = c->stageEnd = 0;
+  if (c->closed) return 0;
+  if (c->useRings)
+    c->stageEnd = ringGet(&c->rings[PCIeRingToFPGA], c->stage, StageBytes);
+  else if (c->canRead) {
+    int n = recv(c->sock, c->stage, StageBytes, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      n = 0;
+    else if (n <= 0)
+      c->closed = 1;
+    if (n < StageBytes) c->canRead = 0;
+    if (n > 0) c->stageEnd = n;
+  }
+  return c->stageEnd;
 }
 
-// Read from socket and write to FPGA
+// Move staged data from client to DMA buffer, without interleaving the
+// commands of different clients
+void txDrain(TxState* s, Client* c)
+{
+  while (c->stageStart < c->stageEnd && s->pending < DMABufferSize) {
+    if (c->payloadLeft == 0) {
+      // Receive header
+      int n = min(16 - c->headerBytes, c->stageEnd - c->stageStart);
+      memcpy((char*) c->header + c->headerBytes, &c->stage[c->stageStart], n);
+      c->headerBytes += n;
+      c->stageStart += n;
+      if (c->headerBytes < 16) break;
+      c->headerBytes = 0;
+      if (! mayAddress(c, c->header[0])) {
+        fprintf(stderr, "pciestreamd: client used address 0x%x "
+                        "outside its sub-mesh\n", c->header[0]);
+        c->closed = 1;
+        c->stageStart = c->stageEnd;
+        break;
+      }
+      if (c->header[1] >= MaxMsgsPerCommand) {
+        fprintf(stderr, "pciestreamd: client sent command with %u "
+                        "messages\n", c->header[1] + 1);
+        c->closed = 1;
+        c->stageStart = c->stageEnd;
+        break;
+      }
+      // Header is at a flit boundary, so there's room for it
+      memcpy((char*) &s->txA[s->pending], c->header, 16);
+      s->pending += 16;
+      c->payloadLeft = 16 * ((uint64_t) c->header[1] + 1) *
+                         ((c->header[2] >> 24) + 1);
+      s->owner = c;
+    }
+    else {
+      // Copy payload
+      int n = min(c->stageEnd - c->stageStart, DMABufferSize - s->pending);
+      if ((uint64_t) n > c->payloadLeft) n = c->payloadLeft;
+      memcpy((char*) &s->txA[s->pending], &c->stage[c->stageStart], n);
+      s->pending += n;
+      c->stageStart += n;
+      c->payloadLeft -= n;
+      if (c->payloadLeft == 0) s->owner = NULL;
+    }
+  }
+}
+
+// Read from clients and write to FPGA
 Status tx(TxState* s)
 {
-  // This flag indicates that data should now be sent
-  int doSend = 0;
+  // Determine if DMA buffer is available
+  if (! s->bufferReady) {
+    if (s->csrs[2*(CSR_LEN_TX_A + s->activeBuffer)] == 0)
+      s->bufferReady = 1;
+    else
+      return FULL;
+  }
 
-  // Send pending data if buffer is full
-  if (s->pending == DMABufferSize) doSend = 1;
+  int progress = 0;
 
-  // Send pending data if: (1) pending is a non-zero multiple of
-  // 16 and (2) there's no data available on the socket.
-  if (s->pending != 0 && (s->pending&0xf) == 0) {
-    struct pollfd fd; fd.fd = s->client; fd.events = POLLIN;
-    int ret = poll(&fd, 1, 0);
-    if (ret <= 0) doSend = 1;
+  // Pad the command of a departed client
+  if (s->padding > 0) {
+    int n = DMABufferSize - s->pending;
+    if ((uint64_t) n > s->padding) n = s->padding;
+    memset((char*) &s->txA[s->pending], 0, n);
+    s->pending += n;
+    s->padding -= n;
+    progress = 1;
   }
 
-  // Try to read data from client
-  if (! doSend) {
-    // Determine if DMA buffer is available
-    if (! s->bufferReady) {
-      if (s->csrs[2*(CSR_LEN_TX_A + s->activeBuffer)] == 0)
-        s->bufferReady = 1;
-      else
-        return FULL;
+  // Serve each client in turn, but once a client has started a
+  // command, serve only that client until the command is complete
+  // (or until it has stalled for too long, and is dropped)
+  int served = 0;
+  while (s->padding == 0 && s->pending < DMABufferSize &&
+           served < numClients) {
+    Client* c = s->owner ? s->owner : clients[s->next];
+    if (txStage(c) > 0) {
+      txDrain(s, c);
+      if (s->owner == c) s->ownerNs = nowNs();
+      progress = 1;
+    }
+    if (s->owner == c) {
+      // Wait for the rest of the command
+      if (c->stageStart == c->stageEnd) {
+        if (nowNs() - s->ownerNs > CommandTimeoutNs) {
+          fprintf(stderr, "pciestreamd: client stalled mid-command\n");
+          c->closed = 1;
+        }
+        break;
+      }
     }
-    // Is there any data to transmit?
-    struct pollfd fd; fd.fd = s->client; fd.events = POLLIN;
-    int ret = poll(&fd, 1, 0);
-    if (ret == 0)
-      return NO_SEND;
-    else if (ret < 0)
-      return CLOSED;
     else {
-      // Read data from client
-      int n = read(s->client, (void*) &s->txA[s->pending],
-                DMABufferSize - s->pending);
-      if (n <= 0) return CLOSED;
-      s->pending += n;
+      s->next = (s->next + 1) % numClients;
+      served++;
     }
   }
 
-  // Send pending data, if requested
-  if (doSend) {
+  // Send pending data if: (1) the buffer is full, or (2) pending is a
+  // non-zero multiple of 16 and there's no more data from the clients.
+  if (s->pending == DMABufferSize ||
+        (!progress && s->pending != 0 && (s->pending&0xf) == 0)) {
     // Flush cache
     mfence();
     for (int i = 0; i < s->pending; i += CacheLineBytes) clflush(&s->txA[i]);
@@ -197,34 +631,100 @@ Status tx(TxState* s)
     // Trigger send
     assert(s->bufferReady && s->pending >= 16);
     s->csrs[2*(CSR_LEN_TX_A + s->activeBuffer)] = s->pending/16;
+    stats.toFPGABytes += s->pending;
+    stats.toFPGABuffers++;
     // Switch buffers
     swap(&s->txA, &s->txB);
     s->activeBuffer = (s->activeBuffer+1)&1;
     s->pending = 0;
     s->bufferReady = 0;
+    progress = 1;
   }
 
-  return PROGRESS;
+  return progress ? PROGRESS : NO_SEND;
 }
 
 // Receiver
 // --------
 
 // Initialise the receiver state
-void rxInit(RxState* s, int client, volatile uint64_t* csrs,
+void rxInit(RxState* s, volatile uint64_t* csrs,
        volatile char* rxA, volatile char* rxB)
 {
-  s->client = client;
   s->csrs = csrs;
   s->rxA = rxA;
   s->rxB = rxB;
   s->activeBuffer = 0;
-  s->written = 0;
+  s->consumed = 0;
   s->available = 0;
+  s->dest = NULL;
+  s->msgBytes = 0;
+}
+
+// Determine client to receive message (NULL if none)
+Client* rxDest(volatile char* msg)
+{
+  if (numClients == 0) return NULL;
+  // An untagged client is alone, and receives everything
+  if (!(clients[0]->req.flags & PCIeSessionTagged)) return clients[0];
+  // Otherwise, the first word of the message is the sender's thread id
+  uint32_t x, y;
+  threadBoard(*(volatile uint32_t*) msg, &x, &y);
+  return boardOwner[y][x];
+}
+
+// Deliver data to client, returning number of bytes delivered
+int rxDeliver(Client* c, const char* buf, int n)
+{
+  if (c->closed) return n;
+  if (c->useRings) {
+    int put = ringPut(&c->rings[PCIeRingFromFPGA], buf, n);
+    c->rxBlocked = put < n;
+    return put;
+  }
+  int sent = 0;
+  // Try writing directly to socket
+  if (c->queueStart == c->queueEnd) {
+    c->queueStart = c->queueEnd = 0;
+    sent = send(c->sock, buf, n, MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) c->closed = 1;
+      sent = 0;
+    }
+  }
+  // Queue the rest
+  if (c->queueEnd + (n - sent) > QueueBytes && c->queueStart > 0) {
+    memmove(c->queue, &c->queue[c->queueStart], c->queueEnd - c->queueStart);
+    c->queueEnd -= c->queueStart;
+    c->queueStart = 0;
+  }
+  int m = min(n - sent, QueueBytes - c->queueEnd);
+  memcpy(&c->queue[c->queueEnd], &buf[sent], m);
+  c->queueEnd += m;
+  return sent + m;
 }
 
-// Read from FPGA and write to socket
-Status rx(RxState* s) 
+// Write queued data to clients
+int rxFlush()
+{
+  int progress = 0;
+  for (int i = 0; i < numClients; i++) {
+    Client* c = clients[i];
+    if (c->closed || c->queueStart == c->queueEnd) continue;
+    int n = send(c->sock, &c->queue[c->queueStart],
+                   c->queueEnd - c->queueStart, MSG_DONTWAIT);
+    if (n > 0) {
+      c->queueStart += n;
+      progress = 1;
+    }
+    else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+      c->closed = 1;
+  }
+  return progress;
+}
+
+// Read from FPGA and write to clients
+Status rx(RxState* s)
 {
   // Determine if data is available to receive
   if (s->available == 0) {
@@ -236,34 +736,329 @@ Status rx(RxState* s)
     mfence();
   }
 
-  // Can we send data to the client?
-  struct pollfd fd; fd.fd = s->client; fd.events = POLLOUT;
-  int ret = poll(&fd, 1, 0);
-  if (ret == 0)
-    return CLIENT_BUSY;
-  else if (ret < 0)
-    return CLOSED;
-  else {
-    // Write data to socket
-    int n = write(s->client, (void*) &s->rxA[s->written],
-              s->available - s->written);
-    if (n <= 0) return CLOSED;
-    s->written += n;
-
-    // Consume data from FPGA
-    if (s->written == s->available) {
-      // Make sure all the reads are done before the next write
-      mfence();
-      // Finished with this buffer
-      s->csrs[2*(CSR_LEN_RX_A + s->activeBuffer)] = 0;
-      // Switch buffers
-      swap(&s->rxA, &s->rxB);
-      s->activeBuffer = (s->activeBuffer+1)&1;
-      s->available = s->written = 0;
+  // Deliver runs of messages with the same destination
+  int progress = 0;
+  while (s->consumed < s->available) {
+    if (s->msgBytes == 0) s->dest = rxDest(&s->rxA[s->consumed]);
+    int end = s->consumed + MsgBytes - s->msgBytes;
+    while (end < s->available && rxDest(&s->rxA[end]) == s->dest)
+      end += MsgBytes;
+    if (end > s->available) end = s->available;
+    int len = end - s->consumed;
+    const char* buf = (const char*) &s->rxA[s->consumed];
+    int n = len;
+    if (s->dest)
+      n = rxDeliver(s->dest, buf, len);
+    else
+      stats.droppedBytes += len;
+    s->consumed += n;
+    s->msgBytes = (s->msgBytes + n) % MsgBytes;
+    if (n > 0) progress = 1;
+    if (n < len) break;
+  }
+
+  // Consume data from FPGA
+  if (s->consumed == s->available) {
+    // Make sure all the reads are done before the next write
+    mfence();
+    // Finished with this buffer
+    s->csrs[2*(CSR_LEN_RX_A + s->activeBuffer)] = 0;
+    stats.fromFPGABytes += s->available;
+    stats.fromFPGABuffers++;
+    // Switch buffers
+    swap(&s->rxA, &s->rxB);
+    s->activeBuffer = (s->activeBuffer+1)&1;
+    s->available = s->consumed = 0;
+  }
+
+  return progress ? PROGRESS : CLIENT_BUSY;
+}
+
+// Loopback device
+// ---------------
+
+// A stand-in for the PCIeStream hardware that sends each message it
+// is given straight back to the host, as it would arrive from a thread:
+// header flit removed and padded to the max message size.  Its CSRs
+// and DMA buffers are plain memory.
+
+// Capacity of the queue of messages waiting to be sent to the host
+#define LoopbackQueueBytes (4 * DMABufferSize)
+
+// Loopback state
+typedef struct {
+  volatile uint64_t* csrs;
+  // DMA buffers, in CSR order
+  volatile char* rx[2];
+  volatile char* tx[2];
+  // Next buffer to be consumed (tx) and filled (rx)
+  int txNext, rxNext;
+  // Payload flits remaining in the current message (-1 if awaiting header)
+  int flitsLeft;
+  // Payload flits received so far in the current message
+  int flitsDone;
+  // Queue of messages to be sent to the host
+  // (followed by the message currently being received)
+  char* queue;
+  int queueLen;
+} Loopback;
+
+// Initialise loopback device
+void loopbackInit(Loopback* lb)
+{
+  lb->csrs = (volatile uint64_t*) calloc(2*(CSR_RESET+1), sizeof(uint64_t));
+  for (int i = 0; i < 2; i++) {
+    lb->rx[i] = (volatile char*) aligned_alloc(CacheLineBytes, DMABufferSize);
+    lb->tx[i] = (volatile char*) aligned_alloc(CacheLineBytes, DMABufferSize);
+  }
+  lb->queue = (char*) malloc(LoopbackQueueBytes + MsgBytes);
+  if (lb->csrs == NULL || lb->queue == NULL) {
+    fprintf(stderr, "pciestreamd: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Handle a reset request
+void loopbackReset(Loopback* lb)
+{
+  for (int i = CSR_LEN_RX_A; i <= CSR_LEN_TX_B; i++) lb->csrs[2*i] = 0;
+  lb->csrs[2*CSR_RESET] = 0;
+  lb->txNext = lb->rxNext = 0;
+  lb->flitsLeft = -1;
+  lb->queueLen = 0;
+}
+
+// Emulate the device, returning true if progress was made
+int loopbackStep(Loopback* lb)
+{
+  int progress = 0;
+  if (lb->csrs[2*CSR_RESET]) loopbackReset(lb);
+  if (! lb->csrs[2*CSR_EN]) return 0;
+
+  // Consume a transmit buffer, if there's room for the resulting messages
+  uint64_t flits = lb->csrs[2*(CSR_LEN_TX_A + lb->txNext)];
+  if (flits != 0 && lb->queueLen <= LoopbackQueueBytes/2) {
+    volatile char* buf = lb->tx[lb->txNext];
+    for (uint64_t i = 0; i < flits; i++) {
+      volatile char* flit = &buf[16*i];
+      if (lb->flitsLeft < 0) {
+        // Header: start a new message
+        uint32_t word2 = *(volatile uint32_t*) &flit[8];
+        lb->flitsLeft = (word2 >> 24) + 1;
+        lb->flitsDone = 0;
+        memset(&lb->queue[lb->queueLen], 0, MsgBytes);
+      }
+      else {
+        if (16*lb->flitsDone < MsgBytes)
+          memcpy(&lb->queue[lb->queueLen + 16*lb->flitsDone],
+                 (const char*) flit, 16);
+        lb->flitsDone++;
+        if (--lb->flitsLeft == 0) {
+          lb->flitsLeft = -1;
+          lb->queueLen += MsgBytes;
+        }
+      }
     }
+    lb->csrs[2*(CSR_LEN_TX_A + lb->txNext)] = 0;
+    lb->txNext ^= 1;
+    progress = 1;
   }
 
-  return PROGRESS;
+  // Fill a receive buffer
+  if (lb->queueLen > 0 && lb->csrs[2*(CSR_LEN_RX_A + lb->rxNext)] == 0) {
+    int n = min(lb->queueLen, DMABufferSize);
+    memcpy((char*) lb->rx[lb->rxNext], lb->queue, n);
+    memmove(lb->queue, &lb->queue[n], lb->queueLen - n + MsgBytes);
+    lb->queueLen -= n;
+    lb->csrs[2*(CSR_LEN_RX_A + lb->rxNext)] = n/16;
+    lb->rxNext ^= 1;
+    progress = 1;
+  }
+
+  return progress;
+}
+
+// Event loop
+// ----------
+
+// The FPGA side can only be polled, so when nothing is happening the
+// event loop keeps polling for a spin window before it sleeps.  By
+// default, the window is the measured cost of a minimal sleep: there's
+// no point sleeping for less.  Sleeps then double in length up to a
+// limit, and end early on a new connection, on data from a socket
+// client, or on a doorbell from a ring client (rung when it sends, or
+// when it frees space in a ring that delivery is waiting on).
+
+// Event loop state
+typedef struct {
+  int epoll;
+  // Listening sockets
+  int sock, ringSock, statsSock;
+  // Timer ending a sleep
+  int timer;
+  // Spin window, and longest sleep
+  uint64_t spinNs, maxSleepNs;
+  // Length of next sleep
+  uint64_t sleepNs;
+  // Time at which loop became idle (zero if busy)
+  uint64_t idleNs;
+} EventLoop;
+
+// Write counters to a client of the stats socket
+void reportStats(EventLoop* loop)
+{
+  int conn = accept(loop->statsSock, NULL, NULL);
+  if (conn == -1) return;
+  uint64_t now = nowNs();
+  double secs = (now - stats.reportNs) / 1e9;
+  char buf[1024];
+  int n = snprintf(buf, sizeof(buf),
+    "uptime_secs %.1f\n"
+    "clients %d\n"
+    "to_fpga_bytes %lu\n"
+    "from_fpga_bytes %lu\n"
+    "to_fpga_bytes_per_sec %.0f\n"
+    "from_fpga_bytes_per_sec %.0f\n"
+    "to_fpga_buffer_fill %.3f\n"
+    "from_fpga_buffer_fill %.3f\n"
+    "dropped_bytes %lu\n"
+    "sleeps %lu\n"
+    "doorbells %lu\n"
+    "spin_ns %lu\n"
+    "max_sleep_ns %lu\n",
+    (now - stats.startNs) / 1e9,
+    numClients,
+    stats.toFPGABytes,
+    stats.fromFPGABytes,
+    (stats.toFPGABytes - stats.reportToFPGABytes) / secs,
+    (stats.fromFPGABytes - stats.reportFromFPGABytes) / secs,
+    stats.toFPGABuffers == 0 ? 0.0 : (double) stats.toFPGABytes /
+      (stats.toFPGABuffers * (double) DMABufferSize),
+    stats.fromFPGABuffers == 0 ? 0.0 : (double) stats.fromFPGABytes /
+      (stats.fromFPGABuffers * (double) DMABufferSize),
+    stats.droppedBytes,
+    stats.sleeps,
+    stats.doorbells,
+    loop->spinNs,
+    loop->maxSleepNs);
+  if (send(conn, buf, n, MSG_DONTWAIT) != n)
+    fprintf(stderr, "pciestreamd: failed to send stats\n");
+  close(conn);
+  stats.reportNs = now;
+  stats.reportToFPGABytes = stats.toFPGABytes;
+  stats.reportFromFPGABytes = stats.fromFPGABytes;
+}
+
+// Handle events, waiting for at most the given time (if non-zero)
+void handleEvents(EventLoop* loop, uint64_t waitNs)
+{
+  struct itimerspec t;
+  memset(&t, 0, sizeof(t));
+  if (waitNs > 0) {
+    t.it_value.tv_sec = waitNs / 1000000000;
+    t.it_value.tv_nsec = waitNs % 1000000000;
+    timerfd_settime(loop->timer, 0, &t, NULL);
+  }
+  struct epoll_event events[2*MaxClients+MaxPending+4];
+  int n = epoll_wait(loop->epoll, events, 2*MaxClients+MaxPending+4,
+                     waitNs > 0 ? -1 : 0);
+  int doorbell = 0;
+  for (int i = 0; i < n; i++) {
+    int fd = events[i].data.fd;
+    if (fd == loop->timer) {
+      uint64_t expirations;
+      if (read(fd, &expirations, sizeof(expirations)) < 0) continue;
+    }
+    else if (fd == loop->sock || fd == loop->ringSock)
+      acceptClient(fd, fd == loop->ringSock, loop->epoll);
+    else if (fd == loop->statsSock)
+      reportStats(loop);
+    else {
+      Client* c = findClient(fd);
+      if (c == NULL) {
+        int p = findPending(fd);
+        if (p >= 0) readRequest(p, loop->epoll);
+        continue;
+      }
+      if (fd != c->sock) {
+        // Doorbell
+        uint64_t count;
+        if (read(fd, &count, sizeof(count)) > 0) doorbell = 1;
+      }
+      // Clients using rings never send on the socket
+      else if (c->useRings) c->closed = 1;
+      // Otherwise, a hang-up is seen when reading returns zero
+      else c->canRead = 1;
+    }
+  }
+  if (numPending > 0) expirePending(loop->epoll);
+  if (waitNs > 0) {
+    // Disarm timer
+    memset(&t, 0, sizeof(t));
+    timerfd_settime(loop->timer, 0, &t, NULL);
+    stats.sleeps++;
+    if (doorbell) stats.doorbells++;
+  }
+}
+
+// Sleep until an event arrives or the given time elapses
+void sleepEvents(EventLoop* loop, uint64_t ns)
+{
+  // Ask ring clients to ring their doorbells: when sending, and when
+  // freeing space in a ring that delivery is waiting on
+  for (int i = 0; i < numClients; i++) {
+    Client* c = clients[i];
+    if (! c->useRings) continue;
+    c->rings[PCIeRingToFPGA].ctrl->consumerWaiting = 1;
+    if (c->rxBlocked) c->rings[PCIeRingFromFPGA].ctrl->producerWaiting = 1;
+  }
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int ready = 0;
+  for (int i = 0; i < numClients; i++) {
+    Client* c = clients[i];
+    if (! c->useRings) continue;
+    if (ringAvailable(&c->rings[PCIeRingToFPGA]) > 0) ready = 1;
+    if (c->rxBlocked && ringSpace(&c->rings[PCIeRingFromFPGA]) > 0)
+      ready = 1;
+  }
+  handleEvents(loop, ready ? 0 : ns);
+  for (int i = 0; i < numClients; i++)
+    if (clients[i]->useRings) {
+      clients[i]->rings[PCIeRingToFPGA].ctrl->consumerWaiting = 0;
+      clients[i]->rings[PCIeRingFromFPGA].ctrl->producerWaiting = 0;
+    }
+}
+
+// Measure the time taken by a minimal sleep
+uint64_t calibrateSpin(EventLoop* loop)
+{
+  const int samples = 100;
+  uint64_t start = nowNs();
+  for (int i = 0; i < samples; i++) handleEvents(loop, MinSleepNs);
+  stats.sleeps = 0;
+  return (nowNs() - start) / samples;
+}
+
+// Called on each iteration of the event loop
+void loopStep(EventLoop* loop, int idle)
+{
+  static uint32_t iter = 0;
+  if (! idle) {
+    loop->idleNs = 0;
+    loop->sleepNs = MinSleepNs;
+    // Check for events regularly when busy
+    if ((++iter & 63) == 0) handleEvents(loop, 0);
+    return;
+  }
+  uint64_t now = nowNs();
+  if (loop->idleNs == 0) loop->idleNs = now;
+  if (now - loop->idleNs < loop->spinNs)
+    handleEvents(loop, 0);
+  else {
+    sleepEvents(loop, loop->sleepNs);
+    loop->sleepNs *= 2;
+    if (loop->sleepNs > loop->maxSleepNs) loop->sleepNs = loop->maxSleepNs;
+  }
 }
 
 // Main function
@@ -272,8 +1067,15 @@ Status rx(RxState* s)
 // Display usage and quit
 void usage()
 {
-  fprintf(stderr, "Usage: pciestreamd [BAR0]\n"
-    "Where BAR0 is a physical address in hex\n");
+  fprintf(stderr, "Usage: pciestreamd [OPTIONS] BAR0\n"
+    "Where BAR0 is a physical address in hex\n"
+    "   or: pciestreamd [OPTIONS] -l\n"
+    "To use a loopback device in place of the FPGA\n"
+    "Options:\n"
+    "  -s USECS  Spin for USECS when idle before sleeping "
+                 "(default: calibrated)\n"
+    "  -m USECS  Sleep for at most USECS when idle (default: 1000)\n"
+    "  -c CORE   Pin to given CPU core\n");
   exit(EXIT_FAILURE);
 }
 
@@ -309,7 +1111,7 @@ volatile char* openDMABuffer(const char* deviceFile, int prot, uint64_t* addr)
 }
 
 // Create listening socket
-int createListener()
+int createListener(const char* name)
 {
   // Create socket
   int sock = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -323,7 +1125,7 @@ int createListener()
   memset(&sockAddr, 0, sizeof(struct sockaddr_un));
   sockAddr.sun_family = AF_UNIX;
   sockAddr.sun_path[0] = '\0';
-  strncpy(&sockAddr.sun_path[1], SOCKET_NAME,
+  strncpy(&sockAddr.sun_path[1], name,
     sizeof(sockAddr.sun_path)-2);
   int ret = bind(sock, (const struct sockaddr *) &sockAddr,
                    sizeof(struct sockaddr_un));
@@ -333,7 +1135,7 @@ int createListener()
   }
 
   // Listen for connections
-  ret = listen(sock, 0);
+  ret = listen(sock, SOMAXCONN);
   if (ret == -1) {
     perror("Control: listen");
     exit(EXIT_FAILURE);
@@ -344,101 +1146,152 @@ int createListener()
 
 int main(int argc, char* argv[])
 {
-  if (argc != 2) usage();
+  // Event loop state
+  EventLoop loop;
+  memset(&loop, 0, sizeof(loop));
+  loop.maxSleepNs = DefaultMaxSleepNs;
+  int useLoopback = 0;
+  int calibrate = 1;
 
-  uint64_t ctrlBAR;
-  if (sscanf(argv[1], "%lx", &ctrlBAR) <= 0) usage();
+  // Parse options
+  int opt;
+  while ((opt = getopt(argc, argv, "ls:m:c:")) != -1) {
+    if (opt == 'l')
+      useLoopback = 1;
+    else if (opt == 's') {
+      loop.spinNs = 1000 * (uint64_t) atoi(optarg);
+      calibrate = 0;
+    }
+    else if (opt == 'm')
+      loop.maxSleepNs = 1000 * (uint64_t) atoi(optarg);
+    else if (opt == 'c') {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(atoi(optarg), &cpus);
+      if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        perror("pciestreamd: sched_setaffinity");
+        exit(EXIT_FAILURE);
+      }
+    }
+    else
+      usage();
+  }
+  if (optind != argc - (useLoopback ? 0 : 1)) usage();
+  if (loop.maxSleepNs < MinSleepNs) loop.maxSleepNs = MinSleepNs;
 
   // Ignore SIGPIPE
   signal(SIGPIPE, SIG_IGN);
 
-  // Obtain access to control BAR
-  // ----------------------------
+  volatile uint64_t* csrs;
+  volatile char *rxA, *rxB, *txA, *txB;
+  uint64_t addrRxA, addrRxB, addrTxA, addrTxB;
 
-  int memDev = open("/dev/mem", O_RDWR);
-  if (memDev == -1)
-  {
-    perror("open /dev/mem");
-    exit(EXIT_FAILURE);
+  // Loopback device, if requested
+  Loopback loopback;
+
+  if (useLoopback) {
+    loopbackInit(&loopback);
+    csrs = loopback.csrs;
+    rxA = loopback.rx[0]; rxB = loopback.rx[1];
+    txA = loopback.tx[0]; txB = loopback.tx[1];
+    addrRxA = addrRxB = addrTxA = addrTxB = 0;
   }
+  else {
+    uint64_t ctrlBAR;
+    if (sscanf(argv[optind], "%lx", &ctrlBAR) <= 0) usage();
 
-  void *csrsPtr =
-    mmap(NULL,
-         0x40000,
-         PROT_READ | PROT_WRITE,
-         MAP_SHARED,
-         memDev,
-         ctrlBAR);
+    // Obtain access to control BAR
+    // ----------------------------
 
-  if (csrsPtr == MAP_FAILED) {
-    perror("mmap csrs");
-    exit(EXIT_FAILURE);
-  }
+    int memDev = open("/dev/mem", O_RDWR);
+    if (memDev == -1)
+    {
+      perror("open /dev/mem");
+      exit(EXIT_FAILURE);
+    }
+
+    void *csrsPtr =
+      mmap(NULL,
+           0x40000,
+           PROT_READ | PROT_WRITE,
+           MAP_SHARED,
+           memDev,
+           ctrlBAR);
 
-  volatile uint64_t* csrs = (uint64_t*) csrsPtr;
+    if (csrsPtr == MAP_FAILED) {
+      perror("mmap csrs");
+      exit(EXIT_FAILURE);
+    }
 
-  // Obtain access to DMA buffers
-  // ----------------------------
+    csrs = (uint64_t*) csrsPtr;
 
-  uint64_t addrRxA, addrRxB, addrTxA, addrTxB;
+    // Obtain access to DMA buffers
+    // ----------------------------
 
-  volatile char* rxA = openDMABuffer("/dev/dmabuffer0", PROT_READ, &addrRxA);
-  volatile char* rxB = openDMABuffer("/dev/dmabuffer1", PROT_READ, &addrRxB);
-  volatile char* txA = openDMABuffer("/dev/dmabuffer2", PROT_WRITE, &addrTxA);
-  volatile char* txB = openDMABuffer("/dev/dmabuffer3", PROT_WRITE, &addrTxB);
+    rxA = openDMABuffer("/dev/dmabuffer0", PROT_READ, &addrRxA);
+    rxB = openDMABuffer("/dev/dmabuffer1", PROT_READ, &addrRxB);
+    txA = openDMABuffer("/dev/dmabuffer2", PROT_WRITE, &addrTxA);
+    txB = openDMABuffer("/dev/dmabuffer3", PROT_WRITE, &addrTxB);
+  }
+
+  // Reset and enable PCIeStream hardware
+  // -------------------------------------
+
+  // This is done once, not per session: the partly-sent command of a
+  // departed client is padded out, and messages to it are dropped
+  csrs[2*CSR_EN] = 0;
+  while (csrs[2*CSR_INFLIGHT] != 0);
+  csrs[2*CSR_RESET] = 1;
+  if (useLoopback) loopbackStep(&loopback);
+  usleep(500000);
+  csrs[2*CSR_ADDR_RX_A] = addrRxA;
+  csrs[2*CSR_ADDR_RX_B] = addrRxB;
+  csrs[2*CSR_ADDR_TX_A] = addrTxA;
+  csrs[2*CSR_ADDR_TX_B] = addrTxB;
+  csrs[2*CSR_EN] = 1;
 
   // Main loop
   // ---------
 
-  // Create listener socket
-  int sock = createListener();
+  // Create listener sockets
+  loop.sock = createListener(SOCKET_NAME);
+  loop.ringSock = createListener(RING_SOCKET_NAME);
+  loop.statsSock = createListener(STATS_SOCKET_NAME);
+
+  // Wait for connections, for data or hang-ups from clients, and for
+  // the end of a sleep
+  loop.epoll = epoll_create1(0);
+  loop.timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (loop.epoll == -1 || loop.timer == -1) {
+    perror("pciestreamd: epoll");
+    exit(EXIT_FAILURE);
+  }
+  int fds[] = { loop.sock, loop.ringSock, loop.statsSock, loop.timer };
+  for (int i = 0; i < 4; i++) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fds[i];
+    epoll_ctl(loop.epoll, EPOLL_CTL_ADD, fds[i], &ev);
+  }
+  stats.startNs = stats.reportNs = nowNs();
+  if (calibrate) loop.spinNs = calibrateSpin(&loop);
+  loop.sleepNs = MinSleepNs;
 
   // Transmitter and receiver state
   TxState txState;
   RxState rxState;
+  txInit(&txState, csrs, txA, txB);
+  rxInit(&rxState, csrs, rxA, rxB);
 
+  // Event loop
   for (;;) {
-    // Reset and disable PCIeStream hardware
-    csrs[2*CSR_EN] = 0;
-    while (csrs[2*CSR_INFLIGHT] != 0);
-    csrs[2*CSR_RESET] = 1;
-    usleep(500000);
-
-    // Accept connection
-    int conn = accept(sock, NULL, NULL);
-    if (conn == -1) {
-      perror("pciestreamd: accept");
-      exit(EXIT_FAILURE);
-    }
-
-    // Reset and enable PCIeStream hardware
-    csrs[2*CSR_EN] = 0;
-    while (csrs[2*CSR_INFLIGHT] != 0);
-    csrs[2*CSR_RESET] = 1;
-    usleep(500000);
-    csrs[2*CSR_ADDR_RX_A] = addrRxA;
-    csrs[2*CSR_ADDR_RX_B] = addrRxB;
-    csrs[2*CSR_ADDR_TX_A] = addrTxA;
-    csrs[2*CSR_ADDR_TX_B] = addrTxB;
-    csrs[2*CSR_EN] = 1;
-
-    // Reset state
-    txInit(&txState, conn, csrs, txA, txB);
-    rxInit(&rxState, conn, csrs, rxA, rxB);
-
-    // Event loop
-    for (;;) {
-      Status txStatus = tx(&txState);
-      if (txStatus == CLOSED) break;
-      Status rxStatus = rx(&rxState);
-      if (rxStatus == CLOSED) break;
-      if (txStatus != PROGRESS && rxStatus != PROGRESS) {
-        if (! alive(conn)) break;
-        usleep(100);
-      }
-    }
-
-    close(conn);
+    Status txStatus = tx(&txState);
+    Status rxStatus = rx(&rxState);
+    int flushed = rxFlush();
+    int devProgress = useLoopback && loopbackStep(&loopback);
+    reapClients(&txState, &rxState, loop.epoll);
+    loopStep(&loop, txStatus != PROGRESS && rxStatus != PROGRESS &&
+                      !flushed && !devProgress);
   }
 
   return 0;
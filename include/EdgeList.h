@@ -3,67 +3,85 @@
 #define _NETWORK_H_
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
-#include <iostream>
-#include <fstream>
-#include <vector>
+#include <GraphFile.h>
+#include <GraphParser.h>
 
+// A directed graph, read from a text file in one of the formats
+// supported by GraphParser.h (by default, a SNAP-style list of
+// (source, destination) pairs) or from a binary graph file (see
+// GraphFile.h).  Edges are held in compressed sparse row form.
 struct EdgeList {
   // Number of nodes and edges
   uint32_t numNodes;
   uint32_t numEdges;
 
-  // Mapping from node id to array of neighbouring node ids
-  // First element of each array holds the number of neighbours
-  uint32_t** neighbours;
+  // The neighbours of node i are held at indices offsets[i] to
+  // offsets[i+1]-1 of the dests array
+  const uint32_t* offsets;
+  const uint32_t* dests;
+
+  // Constructor
+  EdgeList() {
+    numNodes = numEdges = 0;
+    offsets = dests = NULL;
+    ownsArrays = false;
+  }
+
+  // Number of neighbours of given node
+  inline uint32_t fanOut(uint32_t i) const {
+    return offsets[i+1] - offsets[i];
+  }
+
+  // Given neighbour of given node
+  inline uint32_t neighbour(uint32_t i, uint32_t j) const {
+    return dests[offsets[i] + j];
+  }
 
   // Read network from file
   void read(const char* filename)
   {
-    std::fstream file(filename, std::ios_base::in);
-    std::vector<uint32_t> vec;
-
-    // Count number of nodes and edges
-    numEdges = 0;
-    numNodes = 0;
-    uint32_t numInts = 0;
-    uint32_t val;
-    while (file >> val) {
-      vec.push_back(val);
-      numNodes = val >= numNodes ? val+1 : numNodes;
-      numEdges++;
-    }
-    assert((numEdges&1) == 0);
-    numEdges >>= 1;
+    release();
 
-    uint32_t* count = (uint32_t*) calloc(numNodes, sizeof(uint32_t));
-    for (int i = 0; i < vec.size(); i+=2) {
-      count[vec[i]]++;
+    // Binary graph files are used in place
+    if (isGraphFile(filename)) {
+      if (! graphFile.open(filename)) {
+        fprintf(stderr, "Invalid graph file: %s\n", filename);
+        exit(EXIT_FAILURE);
+      }
+      numNodes = graphFile.numNodes;
+      numEdges = graphFile.numEdges;
+      offsets = graphFile.offsets;
+      dests = graphFile.neighbours;
+      return;
     }
 
-    // Create mapping from node id to neighbours
-    neighbours = (uint32_t**) calloc(numNodes, sizeof(uint32_t*));
-    for (int i = 0; i < numNodes; i++) {
-      neighbours[i] = (uint32_t*) calloc(count[i]+1, sizeof(uint32_t));
-      neighbours[i][0] = count[i];
-    }
-    for (int i = 0; i < vec.size(); i+=2) {
-      uint32_t src = vec[i];
-      uint32_t dst = vec[i+1];
-      neighbours[src][count[src]--] = dst;
-    }
- 
-    // Release
-    free(count);
-    file.close();
+    // Otherwise, parse the file as text (see GraphParser.h), listing
+    // each node's neighbours in reverse order of appearance, as this
+    // reader always has (applications derive per-edge values from it)
+    GraphParser parser;
+    if (! parser.parse(filename, GraphAuto, GraphParseReverseOrder))
+      exit(EXIT_FAILURE);
+    numNodes = parser.numNodes;
+    numEdges = parser.numEdges;
+    offsets = parser.offsets;
+    dests = parser.dests;
+    parser.offsets = parser.dests = NULL;
+    ownsArrays = true;
+  }
+
+  // Write network to a binary graph file
+  bool writeBinary(const char* filename) {
+    return writeGraphFile(filename, numNodes, numEdges, offsets, dests);
   }
 
   // Determine max fan-out
   uint32_t maxFanOut() {
     uint32_t max = 0;
     for (uint32_t i = 0; i < numNodes; i++) {
-      uint32_t numNeighbours = neighbours[i][0];
+      uint32_t numNeighbours = fanOut(i);
       if (numNeighbours > max) max = numNeighbours;
     }
     return max;
@@ -73,12 +91,33 @@ struct EdgeList {
   uint32_t minFanOut() {
     uint32_t min = ~0;
     for (uint32_t i = 0; i < numNodes; i++) {
-      uint32_t numNeighbours = neighbours[i][0];
+      uint32_t numNeighbours = fanOut(i);
       if (numNeighbours < min) min = numNeighbours;
     }
     return min;
   }
 
+  // Destructor
+  ~EdgeList() { release(); }
+
+ private:
+  // Backing store when read from a binary graph file
+  GraphFile graphFile;
+
+  // Were the arrays allocated by read()?
+  bool ownsArrays;
+
+  // Release arrays
+  void release() {
+    if (ownsArrays) {
+      free((void*) offsets);
+      free((void*) dests);
+    }
+    graphFile.close();
+    offsets = dests = NULL;
+    numNodes = numEdges = 0;
+    ownsArrays = false;
+  }
 };
 
 #endif
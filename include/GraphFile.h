@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Binary graph file format, in compressed sparse row (CSR) form
+//
+// A graph file consists of a header followed by three sections, each
+// padded to an 8-byte boundary:
+//
+//   1. offsets:    (numNodes+1) x uint32_t
+//   2. neighbours: numEdges x uint32_t
+//   3. labels:     numEdges x labelBytes (absent if labelBytes is 0)
+//
+// The outgoing edges of node x are held at indices offsets[x] to
+// offsets[x+1]-1 of the neighbours (and labels) arrays.  The file is
+// designed to be mapped into memory and used in place, so a graph can
+// be loaded without parsing and shared between several processes.
+// Integers are stored in host byte order.
+
+#ifndef _GRAPHFILE_H_
+#define _GRAPHFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define GraphFileMagic 0x485047534c4f50ul
+#define GraphFileVersion 1
+
+struct GraphFileHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t labelBytes;
+  uint32_t numNodes;
+  uint32_t numEdges;
+};
+
+// Size of a section once padded
+inline uint64_t graphFilePad(uint64_t bytes) {
+  return (bytes + 7) & ~((uint64_t) 7);
+}
+
+// Does the given file start with the graph file magic number?
+inline bool isGraphFile(const char* filename) {
+  FILE* fp = fopen(filename, "rb");
+  if (fp == NULL) return false;
+  uint64_t magic = 0;
+  bool ok = fread(&magic, sizeof(magic), 1, fp) == 1;
+  fclose(fp);
+  return ok && magic == GraphFileMagic;
+}
+
+// Write a graph file, returning false on failure
+inline bool writeGraphFile(const char* filename,
+                           uint32_t numNodes, uint32_t numEdges,
+                           const uint32_t* offsets,
+                           const uint32_t* neighbours,
+                           const void* labels = NULL,
+                           uint32_t labelBytes = 0) {
+  FILE* fp = fopen(filename, "wb");
+  if (fp == NULL) return false;
+  GraphFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = GraphFileMagic;
+  hdr.version = GraphFileVersion;
+  hdr.labelBytes = labels == NULL ? 0 : labelBytes;
+  hdr.numNodes = numNodes;
+  hdr.numEdges = numEdges;
+  const void* data[] = { &hdr, offsets, neighbours, labels };
+  uint64_t size[] = { sizeof(hdr), ((uint64_t) numNodes + 1) * 4,
+                      (uint64_t) numEdges * 4,
+                      (uint64_t) numEdges * hdr.labelBytes };
+  bool ok = true;
+  uint64_t zero = 0;
+  for (uint32_t i = 0; i < 4 && ok; i++) {
+    if (size[i] == 0) continue;
+    uint64_t pad = graphFilePad(size[i]) - size[i];
+    ok = fwrite(data[i], 1, size[i], fp) == size[i] &&
+         fwrite(&zero, 1, pad, fp) == pad;
+  }
+  if (fclose(fp) != 0) ok = false;
+  if (!ok) unlink(filename);
+  return ok;
+}
+
+// A graph file mapped into memory
+struct GraphFile {
+  // Number of nodes and edges
+  uint32_t numNodes;
+  uint32_t numEdges;
+
+  // CSR arrays (pointers into the mapped file)
+  const uint32_t* offsets;
+  const uint32_t* neighbours;
+
+  // Edge labels, and size of each label (NULL and 0 if unlabelled)
+  const void* labels;
+  uint32_t labelBytes;
+
+  // Constructor
+  GraphFile() {
+    numNodes = numEdges = labelBytes = 0;
+    offsets = neighbours = NULL;
+    labels = NULL;
+    base = NULL;
+    size = 0;
+  }
+
+  // Map given file into memory, returning false if it is not a valid
+  // graph file (the whole file is checked, in time linear in its size)
+  bool open(const char* filename) {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(GraphFileHeader)) {
+      void* ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (ptr != MAP_FAILED) {
+        base = (uint8_t*) ptr;
+        size = st.st_size;
+      }
+    }
+    ::close(fd);
+    if (base == NULL) return false;
+    // Check header
+    const GraphFileHeader* hdr = (const GraphFileHeader*) base;
+    uint64_t offsetsBytes = graphFilePad(((uint64_t) hdr->numNodes + 1) * 4);
+    uint64_t neighboursBytes = graphFilePad((uint64_t) hdr->numEdges * 4);
+    uint64_t labelsBytes =
+      graphFilePad((uint64_t) hdr->numEdges * hdr->labelBytes);
+    uint64_t expected = graphFilePad(sizeof(GraphFileHeader)) +
+                          offsetsBytes + neighboursBytes + labelsBytes;
+    if (hdr->magic != GraphFileMagic || hdr->version != GraphFileVersion ||
+          expected > size) {
+      close();
+      return false;
+    }
+    // Locate sections
+    numNodes = hdr->numNodes;
+    numEdges = hdr->numEdges;
+    labelBytes = hdr->labelBytes;
+    const uint8_t* ptr = base + graphFilePad(sizeof(GraphFileHeader));
+    offsets = (const uint32_t*) ptr;
+    ptr += offsetsBytes;
+    neighbours = (const uint32_t*) ptr;
+    ptr += neighboursBytes;
+    labels = labelBytes == 0 ? NULL : (const void*) ptr;
+    // Check offsets are consistent with the number of edges, never
+    // decrease, and that every neighbour is a valid node
+    bool ok = offsets[0] == 0 && offsets[numNodes] == numEdges;
+    for (uint32_t x = 0; ok && x < numNodes; x++)
+      ok = offsets[x] <= offsets[x+1];
+    for (uint32_t i = 0; ok && i < numEdges; i++)
+      ok = neighbours[i] < numNodes;
+    if (!ok) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  // Unmap file
+  void close() {
+    if (base != NULL) munmap(base, size);
+    base = NULL;
+    size = 0;
+    numNodes = numEdges = labelBytes = 0;
+    offsets = neighbours = NULL;
+    labels = NULL;
+  }
+
+  // Destructor
+  ~GraphFile() { close(); }
+
+ private:
+  // Mapped region
+  uint8_t* base;
+  size_t size;
+};
+
+#endif
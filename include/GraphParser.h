@@ -0,0 +1,510 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Parallel parser for text graph formats
+//
+// Supported formats:
+//
+//   * SNAP edge lists: one "src dst" pair per line, 0-based, with
+//     comment lines starting with '#' or '%'.
+//
+//   * Matrix Market coordinate files: a "%%MatrixMarket" banner, comment
+//     lines starting with '%', a "rows cols entries" size line, and one
+//     "row col [value]" entry per line, 1-based.  Each entry (i, j) is an
+//     edge from i to j; values are ignored.  Symmetric matrices have
+//     each off-diagonal entry added in both directions.
+//
+//   * METIS graph files: comment lines starting with '%', an
+//     "n m [fmt [ncon]]" header, and then one line per vertex listing
+//     its neighbours, 1-based.  Vertex sizes, vertex weights and edge
+//     weights (as selected by fmt) are skipped.
+//
+// The file is mapped into memory and split into chunks at line
+// boundaries, which are parsed in parallel (when compiled with OpenMP).
+// The result is built in compressed sparse row form in two parallel
+// passes over the parsed edges.  The first distributes the edges into
+// buckets by source node range, using per-chunk counts and a prefix sum;
+// the second counts, prefix-sums and scatters each bucket independently.
+// No atomics are needed, and each node's neighbours appear in file order
+// (or in reverse file order, with GraphParseReverseOrder), so the result
+// does not depend on the number of threads.
+
+#ifndef _GRAPHPARSER_H_
+#define _GRAPHPARSER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Text graph formats
+enum GraphFormat {
+  GraphAuto,          // Choose using file contents and extension
+  GraphSNAP,
+  GraphMatrixMarket,
+  GraphMETIS
+};
+
+// Parser flags
+#define GraphParseReverse 1     // Reverse the direction of each edge
+#define GraphParseUndirected 2  // Add each edge in both directions
+#define GraphParseReverseOrder 4  // List neighbours in reverse file order
+
+struct GraphParser {
+  // Number of nodes and edges
+  uint32_t numNodes;
+  uint32_t numEdges;
+
+  // The neighbours of node i are held at indices offsets[i] to
+  // offsets[i+1]-1 of the dests array (allocated using malloc; the
+  // caller may take ownership by setting these to NULL)
+  uint32_t* offsets;
+  uint32_t* dests;
+
+  // Constructor
+  GraphParser() {
+    numNodes = numEdges = 0;
+    offsets = dests = NULL;
+  }
+
+  // Destructor
+  ~GraphParser() {
+    free(offsets);
+    free(dests);
+  }
+
+  // Parse given file, returning false (after printing an error) on failure
+  bool parse(const char* filename, GraphFormat format = GraphAuto,
+             uint32_t flags = 0) {
+    free(offsets); free(dests);
+    offsets = dests = NULL;
+    numNodes = numEdges = 0;
+
+    // Map file into memory
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+      fprintf(stderr, "Can't open '%s'\n", filename);
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      fprintf(stderr, "Can't stat '%s'\n", filename);
+      return false;
+    }
+    size_t size = st.st_size;
+    const char* base = NULL;
+    if (size > 0) {
+      void* ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr == MAP_FAILED) {
+        close(fd);
+        fprintf(stderr, "Can't map '%s'\n", filename);
+        return false;
+      }
+      madvise(ptr, size, MADV_SEQUENTIAL);
+      base = (const char*) ptr;
+    }
+    close(fd);
+
+    bool ok = parseMem(filename, base, base + size, format, flags);
+    if (base != NULL) munmap((void*) base, size);
+    return ok;
+  }
+
+ private:
+  // Per-chunk parser state
+  struct Chunk {
+    const char* start;
+    const char* end;
+    // First vertex in chunk (METIS only)
+    uint64_t firstVertex;
+    // Parsed edges, as (src, dst) pairs
+    std::vector<uint32_t> edges;
+    // Largest node id seen
+    uint64_t maxId;
+    // Error message, if any
+    const char* error;
+  };
+
+  // Details from the file header
+  struct Header {
+    GraphFormat format;
+    // Are node ids 1-based?
+    bool oneBased;
+    // Add the reverse of each edge (symmetric Matrix Market)?
+    bool symmetric;
+    // Number of nodes, if given in header (0 otherwise)
+    uint64_t numNodes;
+    // METIS only: ints to skip at start of each line, and per edge
+    uint32_t skipPerVertex;
+    uint32_t skipPerEdge;
+  };
+
+  // Size of chunks handed to each worker
+  static const size_t chunkSize = 1 << 22;
+
+  // Number of node ranges used when building the CSR arrays
+  static const uint32_t numBuckets = 1024;
+
+  // Is this a space or tab?
+  static inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  // Skip spaces and tabs
+  static inline const char* skipBlanks(const char* p, const char* end) {
+    while (p < end && isBlank(*p)) p++;
+    return p;
+  }
+
+  // Move to start of next line
+  static inline const char* nextLine(const char* p, const char* end) {
+    const char* nl = (const char*) memchr(p, '\n', end - p);
+    return nl == NULL ? end : nl + 1;
+  }
+
+  // Parse an unsigned integer, skipping leading blanks.  Returns NULL
+  // if there is no integer before the end of the line.
+  static inline const char* parseNum(const char* p, const char* end,
+                                     uint64_t* val) {
+    p = skipBlanks(p, end);
+    if (p == end || *p < '0' || *p > '9') return NULL;
+    uint64_t n = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+      n = n * 10 + (*p - '0');
+      p++;
+    }
+    // Reject things like "1.5" or "12abc"
+    if (p < end && !isBlank(*p) && *p != '\n') return NULL;
+    *val = n;
+    return p;
+  }
+
+  // Skip a token (used for values that are ignored)
+  static inline const char* skipToken(const char* p, const char* end) {
+    p = skipBlanks(p, end);
+    while (p < end && !isBlank(*p) && *p != '\n') p++;
+    return p;
+  }
+
+  // Is the line at p a comment?
+  static inline bool isComment(const char* p, const char* end,
+                               GraphFormat format) {
+    if (p == end) return false;
+    return *p == '%' || (format == GraphSNAP && *p == '#');
+  }
+
+  // Is the line starting at p blank?
+  static inline bool isBlankLine(const char* p, const char* end) {
+    p = skipBlanks(p, end);
+    return p == end || *p == '\n';
+  }
+
+  // Parse the header, if any, returning the start of the body
+  static const char* parseHeader(const char* filename, const char* p,
+                                 const char* end, GraphFormat format,
+                                 Header* hdr) {
+    // Determine format
+    if (format == GraphAuto) {
+      size_t len = strlen(filename);
+      const char* banner = "%%MatrixMarket";
+      if ((size_t) (end - p) >= strlen(banner) &&
+            !strncmp(p, banner, strlen(banner)))
+        format = GraphMatrixMarket;
+      else if (len > 4 && !strcmp(filename + len - 4, ".mtx"))
+        format = GraphMatrixMarket;
+      else if ((len > 6 && !strcmp(filename + len - 6, ".graph")) ||
+               (len > 6 && !strcmp(filename + len - 6, ".metis")))
+        format = GraphMETIS;
+      else
+        format = GraphSNAP;
+    }
+    hdr->format = format;
+    hdr->oneBased = format != GraphSNAP;
+    hdr->symmetric = false;
+    hdr->numNodes = 0;
+    hdr->skipPerVertex = hdr->skipPerEdge = 0;
+    if (format == GraphSNAP) return p;
+
+    // Matrix Market banner
+    if (format == GraphMatrixMarket && p < end && *p == '%') {
+      const char* eol = nextLine(p, end);
+      std::string banner(p, eol - p);
+      if (banner.find("symmetric") != std::string::npos ||
+          banner.find("hermitian") != std::string::npos)
+        hdr->symmetric = true;
+      if (banner.find("array") != std::string::npos) {
+        fprintf(stderr, "%s: Matrix Market array format not supported\n",
+                filename);
+        return NULL;
+      }
+    }
+
+    // Skip comments
+    while (p < end && (isComment(p, end, format) || isBlankLine(p, end)))
+      p = nextLine(p, end);
+
+    // Header line
+    uint64_t nums[4] = { 0, 0, 0, 0 };
+    uint32_t count = 0;
+    const char* q = p;
+    while (count < 4) {
+      const char* r = parseNum(q, end, &nums[count]);
+      if (r == NULL) break;
+      q = r; count++;
+    }
+    if (count < 2 || (format == GraphMatrixMarket && count < 3)) {
+      fprintf(stderr, "%s: malformed header\n", filename);
+      return NULL;
+    }
+    if (format == GraphMatrixMarket) {
+      hdr->numNodes = nums[0] > nums[1] ? nums[0] : nums[1];
+    }
+    else {
+      hdr->numNodes = nums[0];
+      uint64_t fmt = count > 2 ? nums[2] : 0;
+      uint64_t ncon = count > 3 ? nums[3] : 1;
+      bool hasSizes = (fmt / 100) % 10;
+      bool hasWeights = (fmt / 10) % 10;
+      bool hasEdgeWeights = fmt % 10;
+      hdr->skipPerVertex = (hasSizes ? 1 : 0) + (hasWeights ? ncon : 0);
+      hdr->skipPerEdge = hasEdgeWeights ? 1 : 0;
+    }
+    if (hdr->numNodes > 0xffffffff) {
+      fprintf(stderr, "%s: too many nodes\n", filename);
+      return NULL;
+    }
+    return nextLine(p, end);
+  }
+
+  // Count the vertex lines in a chunk (METIS only)
+  static uint64_t countVertices(const char* p, const char* end) {
+    uint64_t n = 0;
+    while (p < end) {
+      if (*p != '%') n++;
+      p = nextLine(p, end);
+    }
+    return n;
+  }
+
+  // Add a parsed edge to a chunk
+  static inline void addEdge(Chunk* c, const Header* hdr, uint32_t flags,
+                             uint64_t src, uint64_t dst) {
+    if (flags & GraphParseReverse) std::swap(src, dst);
+    c->edges.push_back((uint32_t) src);
+    c->edges.push_back((uint32_t) dst);
+    if (src > c->maxId) c->maxId = src;
+    if (dst > c->maxId) c->maxId = dst;
+    if ((flags & GraphParseUndirected) || (hdr->symmetric && src != dst)) {
+      c->edges.push_back((uint32_t) dst);
+      c->edges.push_back((uint32_t) src);
+    }
+  }
+
+  // Parse a chunk
+  static void parseChunk(Chunk* c, const Header* hdr, uint32_t flags) {
+    const char* p = c->start;
+    const char* end = c->end;
+    uint64_t vertex = c->firstVertex;
+    uint64_t base = hdr->oneBased ? 1 : 0;
+    c->maxId = 0;
+    c->error = NULL;
+    // Guess the number of edges from the chunk size
+    c->edges.reserve((end - p) / 6);
+    while (p < end) {
+      const char* eol = nextLine(p, end);
+      if (isComment(p, end, hdr->format)) { p = eol; continue; }
+      if (hdr->format == GraphMETIS) {
+        // Skip vertex size and weights
+        const char* q = p;
+        for (uint32_t i = 0; i < hdr->skipPerVertex; i++)
+          q = skipToken(q, eol);
+        // Neighbours
+        uint64_t dst;
+        const char* r;
+        while ((r = parseNum(q, eol, &dst)) != NULL) {
+          if (dst < base) { c->error = "node id out of range"; return; }
+          addEdge(c, hdr, flags, vertex, dst - base);
+          q = r;
+          for (uint32_t i = 0; i < hdr->skipPerEdge; i++)
+            q = skipToken(q, eol);
+        }
+        if (! isBlankLine(q, eol)) { c->error = "malformed line"; return; }
+        vertex++;
+      }
+      else {
+        if (isBlankLine(p, eol)) { p = eol; continue; }
+        uint64_t src, dst;
+        const char* q = parseNum(p, eol, &src);
+        if (q != NULL) q = parseNum(q, eol, &dst);
+        if (q == NULL || src < base || dst < base) {
+          c->error = "malformed edge";
+          return;
+        }
+        src -= base; dst -= base;
+        if (src > 0xfffffffe || dst > 0xfffffffe) {
+          c->error = "node id out of range";
+          return;
+        }
+        addEdge(c, hdr, flags, src, dst);
+      }
+      p = eol;
+    }
+  }
+
+  // Parse file contents
+  bool parseMem(const char* filename, const char* start, const char* end,
+                GraphFormat format, uint32_t flags) {
+    // Header
+    Header hdr;
+    const char* body = parseHeader(filename, start, end, format, &hdr);
+    if (body == NULL) return false;
+
+    // Split body into chunks at line boundaries
+    std::vector<Chunk> chunks;
+    const char* p = body;
+    while (p < end) {
+      Chunk c;
+      c.start = p;
+      c.end = (size_t) (end - p) <= chunkSize ? end
+                : nextLine(p + chunkSize - 1, end);
+      c.firstVertex = 0;
+      c.maxId = 0;
+      c.error = NULL;
+      chunks.push_back(c);
+      p = c.end;
+    }
+    int64_t numChunks = chunks.size();
+
+    // For METIS, determine the first vertex of each chunk
+    if (hdr.format == GraphMETIS) {
+      #pragma omp parallel for schedule(dynamic)
+      for (int64_t i = 0; i < numChunks; i++)
+        chunks[i].firstVertex = countVertices(chunks[i].start, chunks[i].end);
+      uint64_t next = 0;
+      for (int64_t i = 0; i < numChunks; i++) {
+        uint64_t n = chunks[i].firstVertex;
+        chunks[i].firstVertex = next;
+        next += n;
+      }
+    }
+
+    // Parse chunks
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < numChunks; i++)
+      parseChunk(&chunks[i], &hdr, flags);
+
+    // Check for errors and determine number of nodes and edges
+    uint64_t maxId = 0;
+    uint64_t totalEdges = 0;
+    bool anyEdges = false;
+    for (int64_t i = 0; i < numChunks; i++) {
+      Chunk* c = &chunks[i];
+      if (c->error != NULL) {
+        fprintf(stderr, "%s: %s\n", filename, c->error);
+        return false;
+      }
+      if (c->edges.size() > 0) {
+        anyEdges = true;
+        if (c->maxId > maxId) maxId = c->maxId;
+      }
+      totalEdges += c->edges.size() / 2;
+    }
+    uint64_t nodes = anyEdges ? maxId + 1 : 0;
+    if (hdr.format != GraphSNAP) {
+      if (anyEdges && maxId >= hdr.numNodes) {
+        fprintf(stderr, "%s: node id out of range\n", filename);
+        return false;
+      }
+      nodes = hdr.numNodes;
+    }
+    if (totalEdges > 0xffffffff) {
+      fprintf(stderr, "%s: too many edges\n", filename);
+      return false;
+    }
+    numNodes = (uint32_t) nodes;
+    numEdges = (uint32_t) totalEdges;
+
+    // Pass 1: distribute the edges into buckets by source node range,
+    // using per-chunk counts and a prefix sum to preserve file order
+    // (The largest node id, numNodes-1, must fall in the last bucket)
+    uint32_t shift = 0;
+    while (numNodes > 0 && ((numNodes-1) >> shift) >= numBuckets) shift++;
+    uint64_t* pos = (uint64_t*) calloc(numChunks * numBuckets + 1,
+                                       sizeof(uint64_t));
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < numChunks; i++) {
+      std::vector<uint32_t>& edges = chunks[i].edges;
+      uint64_t* count = &pos[i * numBuckets];
+      for (size_t j = 0; j < edges.size(); j += 2)
+        count[edges[j] >> shift]++;
+    }
+    uint64_t bucketStart[numBuckets+1];
+    uint64_t acc = 0;
+    for (uint32_t b = 0; b < numBuckets; b++) {
+      bucketStart[b] = acc;
+      for (int64_t i = 0; i < numChunks; i++) {
+        uint64_t n = pos[i * numBuckets + b];
+        pos[i * numBuckets + b] = acc;
+        acc += n;
+      }
+    }
+    bucketStart[numBuckets] = acc;
+    uint32_t* bucketed = (uint32_t*) malloc(2 * acc * sizeof(uint32_t) + 1);
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < numChunks; i++) {
+      std::vector<uint32_t>& edges = chunks[i].edges;
+      uint64_t* next = &pos[i * numBuckets];
+      for (size_t j = 0; j < edges.size(); j += 2) {
+        uint64_t k = next[edges[j] >> shift]++;
+        bucketed[2*k] = edges[j];
+        bucketed[2*k+1] = edges[j+1];
+      }
+      std::vector<uint32_t>().swap(edges);
+    }
+    free(pos);
+
+    // Pass 2: within each bucket, count the degree of each node,
+    // compute offsets using a prefix sum, and scatter the edges
+    offsets = (uint32_t*) malloc(((uint64_t) numNodes+1) * sizeof(uint32_t));
+    dests = (uint32_t*) malloc((uint64_t) numEdges * sizeof(uint32_t) + 1);
+    offsets[numNodes] = numEdges;
+    bool reverseOrder = flags & GraphParseReverseOrder;
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t b = 0; b < (int64_t) numBuckets; b++) {
+      uint64_t lo = (uint64_t) b << shift;
+      uint64_t hi = (uint64_t) (b+1) << shift;
+      if (hi > numNodes) hi = numNodes;
+      if (lo >= hi) continue;
+      for (uint64_t x = lo; x < hi; x++) offsets[x] = 0;
+      for (uint64_t k = bucketStart[b]; k < bucketStart[b+1]; k++)
+        offsets[bucketed[2*k]]++;
+      // Each node's cursor starts at the beginning of its neighbours,
+      // or at the end when filling them in reverse order
+      uint32_t* cursor = (uint32_t*) malloc((hi - lo) * sizeof(uint32_t));
+      uint32_t sum = (uint32_t) bucketStart[b];
+      for (uint64_t x = lo; x < hi; x++) {
+        uint32_t n = offsets[x];
+        offsets[x] = sum;
+        sum += n;
+        cursor[x - lo] = reverseOrder ? sum : offsets[x];
+      }
+      for (uint64_t k = bucketStart[b]; k < bucketStart[b+1]; k++) {
+        uint32_t* c = &cursor[bucketed[2*k] - lo];
+        if (reverseOrder) dests[--*c] = bucketed[2*k+1];
+        else dests[(*c)++] = bucketed[2*k+1];
+      }
+      free(cursor);
+    }
+    free(bucketed);
+
+    return true;
+  }
+};
+
+#endif
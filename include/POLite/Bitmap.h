@@ -5,22 +5,31 @@
 #include <assert.h>
 #include <POLite/Seq.h>
 
+// A growable bitmap with a summary level: bit i of the summary is set
+// when word i of the bitmap is full, so free words can be found 64 at
+// a time, and the first word free in several bitmaps can be found by
+// ANDing their summaries
 struct Bitmap {
   // Bitmap contents (sequence of 64-bit words)
   Seq<uint64_t>* contents;
 
+  // Summary of full words in contents (sequence of 64-bit words)
+  Seq<uint64_t>* full;
+
   // Index of first non-full word in bitmap
   uint32_t firstFree;
 
   // Constructor
   Bitmap() {
     contents = new Seq<uint64_t> (16);
+    full = new Seq<uint64_t> (1);
     firstFree = 0;
   }
 
   // Destructor
   ~Bitmap() {
     if (contents) delete contents;
+    if (full) delete full;
   }
 
   // Get value of word at given index, return 0 if out-of-bounds
@@ -28,20 +37,30 @@ struct Bitmap {
     return index >= contents->numElems ? 0ul : contents->elems[index];
   }
 
+  // Get value of summary word at given index, return 0 if out-of-bounds
+  inline uint64_t getFullWord(uint32_t index) {
+    return index >= full->numElems ? 0ul : full->elems[index];
+  }
+
   // Find index of next free word in bitmap starting from given word index
   inline uint32_t nextFreeWordFrom(uint32_t start) {
-    for (uint32_t i = start; i < contents->numElems; i++)
-      if (~contents->elems[i] != 0ul) return i;
-    return contents->numElems;
+    uint32_t s = start >> 6;
+    uint64_t avail = ~getFullWord(s) & (~0ul << (start & 63));
+    while (avail == 0) avail = ~getFullWord(++s);
+    return 64*s + __builtin_ctzll(avail);
   }
 
   // Set bit at given index and bit offset in bitmap
   inline void setBit(uint32_t wordIndex, uint32_t bitIndex) {
-    for (uint32_t i = contents->numElems; i <= wordIndex; i++)
-      contents->append(0ul);
-    contents->elems[wordIndex] |= 1ul << bitIndex;
-    if (wordIndex == firstFree) {
-      firstFree = nextFreeWordFrom(firstFree);
+    if (wordIndex >= contents->numElems)
+      contents->extendBy(wordIndex + 1 - contents->numElems);
+    uint64_t word = contents->elems[wordIndex] | (1ul << bitIndex);
+    contents->elems[wordIndex] = word;
+    if (~word == 0ul) {
+      uint32_t s = wordIndex >> 6;
+      if (s >= full->numElems) full->extendBy(s + 1 - full->numElems);
+      full->elems[s] |= 1ul << (wordIndex & 63);
+      if (wordIndex == firstFree) firstFree = nextFreeWordFrom(firstFree);
     }
   }
 
@@ -3,6 +3,7 @@
 #define _GRAPH_H_
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <POLite/Seq.h>
 
@@ -10,92 +11,246 @@ typedef uint32_t NodeId;
 typedef int32_t PinId;
 typedef uint32_t NodeLabel;
 
-struct Graph {
-  // Incoming and outgoing edges
-  // Invariant: these two sequences always have equal length
-  Seq<Seq<NodeId>*>* incoming;
-  Seq<Seq<NodeId>*>* outgoing;
+// A graph is constructed in two phases.  In the build phase, nodes
+// and edges are added and edges are simply appended to a pending edge
+// list.  In the frozen phase, the edges are stored in compressed sparse
+// row (CSR) form: the outgoing edges of node x are held at indices
+// outOffsets[x] to outOffsets[x+1]-1 of the outNeighbours and outPins
+// arrays, and similarly for incoming edges.  Calling freeze() moves
+// from the build phase to the frozen phase; adding further edges after
+// that is allowed, and they are merged in on the next freeze().  The
+// order of edges within each node's lists is always insertion order.
 
-  // Each outgoing edge has a pin id
-  // Invariant: this sequence always has the same structure as 'outgoing'
-  Seq<Seq<PinId>*>* pins;
+struct Graph {
+  // Number of nodes and edges
+  uint32_t numNodes;
+  uint32_t numEdges;
 
   // Each node has a label
   Seq<NodeLabel>* labels;
 
+  // Outgoing edges and their pin ids, in CSR form
+  // (Only valid when the graph is frozen)
+  uint32_t* outOffsets;
+  NodeId* outNeighbours;
+  PinId* outPins;
+
+  // Incoming edges, in CSR form
+  // (Only valid when the graph is frozen)
+  uint32_t* inOffsets;
+  NodeId* inNeighbours;
+
+  // Edges added since the last freeze, in insertion order
+  Seq<NodeId>* pendingSrc;
+  Seq<NodeId>* pendingDst;
+  Seq<PinId>* pendingPin;
+
+  // Number of nodes and edges covered by the CSR arrays
+  uint32_t csrNodes;
+  uint32_t numFrozenEdges;
+
   // Constructor
   Graph() {
     const uint32_t initialCapacity = 4096;
-    incoming = new Seq<Seq<NodeId>*> (initialCapacity);
-    outgoing = new Seq<Seq<NodeId>*> (initialCapacity);
-    pins = new Seq<Seq<PinId>*> (initialCapacity);
+    numNodes = numEdges = 0;
+    csrNodes = numFrozenEdges = 0;
     labels = new Seq<NodeLabel> (initialCapacity);
+    pendingSrc = new Seq<NodeId> (initialCapacity);
+    pendingDst = new Seq<NodeId> (initialCapacity);
+    pendingPin = new Seq<PinId> (initialCapacity);
+    outOffsets = (uint32_t*) calloc(1, sizeof(uint32_t));
+    inOffsets = (uint32_t*) calloc(1, sizeof(uint32_t));
+    outNeighbours = NULL;
+    outPins = NULL;
+    inNeighbours = NULL;
   }
 
   // Deconstructor
   ~Graph() {
-    for (uint32_t i = 0; i < incoming->numElems; i++) {
-      delete incoming->elems[i];
-      delete outgoing->elems[i];
-      delete pins->elems[i];
-    }
-    delete incoming;
-    delete outgoing;
-    delete pins;
     delete labels;
+    delete pendingSrc;
+    delete pendingDst;
+    delete pendingPin;
+    free(outOffsets);
+    free(outNeighbours);
+    free(outPins);
+    free(inOffsets);
+    free(inNeighbours);
   }
 
   // Add new node
   NodeId newNode() {
-    const uint32_t initialCapacity = 8;
-    incoming->append(new Seq<NodeId> (initialCapacity));
-    outgoing->append(new Seq<NodeId> (initialCapacity));
-    pins->append(new Seq<PinId> (initialCapacity));
-    labels->append(incoming->numElems - 1);
-    return incoming->numElems - 1;
+    labels->append(numNodes);
+    return numNodes++;
   }
 
   // Set node label
   void setLabel(NodeId id, NodeLabel lab) {
-    assert(id < labels->numElems);
+    assert(id < numNodes);
     labels->elems[id] = lab;
   }
 
   // Add edge using output pin 0
   void addEdge(NodeId x, NodeId y) {
-    outgoing->elems[x]->append(y);
-    pins->elems[x]->append(0);
-    incoming->elems[y]->append(x);
+    addEdge(x, 0, y);
   }
 
   // Add edge using given output pin
   void addEdge(NodeId x, PinId p, NodeId y) {
-    outgoing->elems[x]->append(y);
-    pins->elems[x]->append(p);
-    incoming->elems[y]->append(x);
+    assert(x < numNodes && y < numNodes);
+    pendingSrc->append(x);
+    pendingDst->append(y);
+    pendingPin->append(p);
+    numEdges++;
+  }
+
+  // Are all edges stored in CSR form?
+  inline bool isFrozen() {
+    return pendingSrc->numElems == 0 && csrNodes == numNodes;
+  }
+
+  // Move to the frozen phase
+  void freeze() {
+    uint32_t* slot = merge();
+    free(slot);
+  }
+
+  // Move to the frozen phase, permuting the given per-edge data so that
+  // it has the same structure as the outgoing edge arrays.  On entry,
+  // the first numFrozenEdges elements of the data are in CSR order, and
+  // the remainder correspond to the pending edges, in insertion order.
+  template <typename T> void freeze(Seq<T>* edgeData) {
+    assert(edgeData->numElems == numEdges);
+    if (isFrozen()) return;
+    uint32_t oldNumNodes = csrNodes;
+    uint32_t* oldOffsets = (uint32_t*)
+      malloc((oldNumNodes+1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i <= oldNumNodes; i++) oldOffsets[i] = outOffsets[i];
+    uint32_t numOld = numFrozenEdges;
+    uint32_t* slot = merge();
+    Seq<T> newData(numEdges);
+    T* newElems = newData.elems;
+    for (uint32_t x = 0; x < oldNumNodes; x++) {
+      uint32_t base = outOffsets[x];
+      for (uint32_t i = oldOffsets[x]; i < oldOffsets[x+1]; i++)
+        newElems[base + i - oldOffsets[x]] = edgeData->elems[i];
+    }
+    for (uint32_t i = numOld; i < numEdges; i++)
+      newElems[slot[i - numOld]] = edgeData->elems[i];
+    newData.numElems = numEdges;
+    edgeData->swap(newData);
+    free(oldOffsets);
+    free(slot);
+  }
+
+  // Outgoing neighbours of given node
+  inline NodeId* outgoing(NodeId x) {
+    return &outNeighbours[outOffsets[x]];
+  }
+
+  // Output pins of the outgoing edges of given node
+  inline PinId* pins(NodeId x) {
+    return &outPins[outOffsets[x]];
+  }
+
+  // Incoming neighbours of given node
+  inline NodeId* incoming(NodeId x) {
+    return &inNeighbours[inOffsets[x]];
   }
 
   // Determine max pin used by given node
   // (Returns -1 if node has no outgoing edges)
   PinId maxPin(NodeId x) {
     int max = -1;
-    for (uint32_t i = 0; i < pins->elems[x]->numElems; i++) {
-      if (pins->elems[x]->elems[i] > max)
-        max = pins->elems[x]->elems[i];
+    for (uint32_t i = outOffsets[x]; i < outOffsets[x+1]; i++) {
+      if (outPins[i] > max) max = outPins[i];
     }
     return max;
   }
 
   // Determine fan-in of given node
   uint32_t fanIn(NodeId id) {
-    return incoming->elems[id]->numElems;
+    return inOffsets[id+1] - inOffsets[id];
   }
 
   // Determine fan-out of given node
   uint32_t fanOut(NodeId id) {
-    return outgoing->elems[id]->numElems;
+    return outOffsets[id+1] - outOffsets[id];
+  }
+
+ private:
+  // Merge existing CSR edges in one direction with the pending edges,
+  // given the pending edge endpoints on each side.  Returns the new
+  // offset array and, if requested, the CSR index of each pending edge.
+  uint32_t* mergeDir(uint32_t* oldOffsets, NodeId* oldNeighbours,
+                       PinId* oldPins, Seq<NodeId>* from, Seq<NodeId>* to,
+                       Seq<PinId>* pinsFrom, NodeId** newNeighbours,
+                       PinId** newPins, uint32_t* slot) {
+    uint32_t numPending = from->numElems;
+    // Count edges per node
+    uint32_t* offsets = (uint32_t*) calloc(numNodes+1, sizeof(uint32_t));
+    for (uint32_t x = 0; x < csrNodes; x++)
+      offsets[x+1] = oldOffsets[x+1] - oldOffsets[x];
+    for (uint32_t i = 0; i < numPending; i++)
+      offsets[from->elems[i]+1]++;
+    // Prefix sum
+    for (uint32_t x = 0; x < numNodes; x++)
+      offsets[x+1] += offsets[x];
+    // Copy existing edges, leaving a cursor at the end of each list
+    NodeId* neighbours = (NodeId*) malloc(numEdges * sizeof(NodeId) + 1);
+    PinId* pinArray = pinsFrom ?
+      (PinId*) malloc(numEdges * sizeof(PinId) + 1) : NULL;
+    uint32_t* cursor = (uint32_t*) malloc((numNodes+1) * sizeof(uint32_t));
+    for (uint32_t x = 0; x < numNodes; x++) {
+      cursor[x] = offsets[x];
+      if (x < csrNodes) {
+        for (uint32_t i = oldOffsets[x]; i < oldOffsets[x+1]; i++) {
+          neighbours[cursor[x]] = oldNeighbours[i];
+          if (pinArray) pinArray[cursor[x]] = oldPins[i];
+          cursor[x]++;
+        }
+      }
+    }
+    // Append pending edges in insertion order
+    for (uint32_t i = 0; i < numPending; i++) {
+      uint32_t s = cursor[from->elems[i]]++;
+      neighbours[s] = to->elems[i];
+      if (pinArray) pinArray[s] = pinsFrom->elems[i];
+      if (slot) slot[i] = s;
+    }
+    free(cursor);
+    *newNeighbours = neighbours;
+    if (newPins) *newPins = pinArray;
+    return offsets;
   }
 
+  // Merge pending edges into the CSR arrays
+  // Returns the CSR index of each pending edge (caller must free)
+  uint32_t* merge() {
+    uint32_t numPending = pendingSrc->numElems;
+    uint32_t* slot = (uint32_t*) malloc(numPending * sizeof(uint32_t) + 1);
+    if (isFrozen()) return slot;
+    // Outgoing direction
+    NodeId* outN; PinId* outP;
+    uint32_t* outO = mergeDir(outOffsets, outNeighbours, outPins,
+                       pendingSrc, pendingDst, pendingPin,
+                       &outN, &outP, slot);
+    // Incoming direction
+    NodeId* inN;
+    uint32_t* inO = mergeDir(inOffsets, inNeighbours, NULL,
+                      pendingDst, pendingSrc, NULL, &inN, NULL, NULL);
+    // Replace CSR arrays
+    free(outOffsets); free(outNeighbours); free(outPins);
+    free(inOffsets); free(inNeighbours);
+    outOffsets = outO; outNeighbours = outN; outPins = outP;
+    inOffsets = inO; inNeighbours = inN;
+    csrNodes = numNodes;
+    numFrozenEdges = numEdges;
+    pendingSrc->clear();
+    pendingDst->clear();
+    pendingPin->clear();
+    return slot;
+  }
 };
 
 #endif
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Support for caching the result of the POLite mapper on disk
+
+#ifndef _MAPCACHE_H_
+#define _MAPCACHE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// A cache file consists of this header followed by a sequence of
+// sections, each padded to an 8-byte boundary.  The layout of the
+// sections is fixed by the header fields, so the file can be mapped
+// into memory and consumed in place.
+#define PMapCacheMagic 0x45484341435050ul
+#define PMapCacheVersion 2
+
+struct PMapCacheHeader {
+  uint64_t magic;
+  uint64_t hash;
+  uint32_t version;
+  uint32_t numDevices;
+  uint32_t numBoardsX;
+  uint32_t numBoardsY;
+  uint32_t maxThreads;
+  uint32_t unused;
+};
+
+// Hash a block of memory, continuing from a given hash value
+// (A simple word-at-a-time multiplicative hash; not cryptographic)
+inline uint64_t mapCacheHash(uint64_t h, const void* data, size_t bytes) {
+  const uint8_t* ptr = (const uint8_t*) data;
+  const uint64_t mul = 0x9e3779b97f4a7c15ul;
+  while (bytes >= 8) {
+    uint64_t w;
+    memcpy(&w, ptr, 8);
+    h = (h ^ w) * mul;
+    h ^= h >> 29;
+    ptr += 8; bytes -= 8;
+  }
+  uint64_t w = bytes;
+  for (size_t i = 0; i < bytes; i++) w = (w << 8) | ptr[i];
+  h = (h ^ w) * mul;
+  h ^= h >> 29;
+  return h;
+}
+
+// Hash a single value
+template <typename T> inline uint64_t mapCacheHashVal(uint64_t h, T x) {
+  return mapCacheHash(h, &x, sizeof(T));
+}
+
+// Hash a string (NULL is treated as the empty string)
+inline uint64_t mapCacheHashStr(uint64_t h, const char* str) {
+  return str == NULL ? mapCacheHash(h, "", 0)
+                     : mapCacheHash(h, str, strlen(str));
+}
+
+// Write sections to a cache file
+class PMapCacheWriter {
+  FILE* fp;
+  char* tmpName;
+  char* finalName;
+  bool ok;
+
+ public:
+  // Open temporary file; it is renamed to the given name on commit
+  PMapCacheWriter(const char* filename) {
+    finalName = strdup(filename);
+    tmpName = (char*) malloc(strlen(filename) + 32);
+    sprintf(tmpName, "%s.tmp%d", filename, (int) getpid());
+    fp = fopen(tmpName, "wb");
+    ok = fp != NULL;
+  }
+
+  // Write a section
+  void write(const void* data, size_t bytes) {
+    if (!ok) return;
+    if (bytes > 0 && fwrite(data, 1, bytes, fp) != bytes) ok = false;
+    uint64_t zero = 0;
+    size_t pad = (8 - (bytes & 7)) & 7;
+    if (pad > 0 && fwrite(&zero, 1, pad, fp) != pad) ok = false;
+  }
+
+  // Close file and make it visible; returns false on failure
+  bool commit() {
+    if (fp != NULL) {
+      if (fclose(fp) != 0) ok = false;
+      fp = NULL;
+    }
+    if (ok) ok = rename(tmpName, finalName) == 0;
+    if (!ok) unlink(tmpName);
+    return ok;
+  }
+
+  // Destructor
+  ~PMapCacheWriter() {
+    if (fp != NULL) { fclose(fp); unlink(tmpName); }
+    free(tmpName);
+    free(finalName);
+  }
+};
+
+// Read sections from a memory-mapped cache file
+class PMapCacheReader {
+  uint8_t* base;
+  size_t size;
+  size_t offset;
+
+ public:
+  // Set when a read runs past the end of the file
+  bool overrun;
+
+  // Map given file into memory; check valid() before use
+  PMapCacheReader(const char* filename) {
+    base = NULL;
+    size = offset = 0;
+    overrun = false;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void* ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        base = (uint8_t*) ptr;
+        size = st.st_size;
+      }
+    }
+    close(fd);
+  }
+
+  // Was the file opened successfully?
+  bool valid() { return base != NULL; }
+
+  // Return pointer to next section, of given size, in place
+  const void* read(size_t bytes) {
+    size_t padded = (bytes + 7) & ~((size_t) 7);
+    if (base == NULL || offset + padded > size) {
+      overrun = true;
+      return NULL;
+    }
+    const void* ptr = &base[offset];
+    offset += padded;
+    return ptr;
+  }
+
+  // Copy next section, of given size, to given buffer
+  bool readInto(void* buf, size_t bytes) {
+    const void* ptr = read(bytes);
+    if (ptr == NULL) return false;
+    memcpy(buf, ptr, bytes);
+    return true;
+  }
+
+  // Destructor
+  ~PMapCacheReader() {
+    if (base != NULL) munmap(base, size);
+  }
+};
+
+#endif
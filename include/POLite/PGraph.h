@@ -4,6 +4,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <math.h>
 #include <HostLink.h>
@@ -14,6 +15,9 @@
 #include <POLite/Placer.h>
 #include <POLite/Bitmap.h>
 #include <POLite/ProgRouters.h>
+#include <POLite/ProgRouterSim.h>
+#include <POLite/MapCache.h>
+#include <new>
 #include <type_traits>
 #include <tinsel-interface.h>
 
@@ -31,7 +35,7 @@ template <typename E> struct PReceiverGroup {
 
 // This structure holds info about an edge destination
 struct PEdgeDest {
-  // Index of edge in outgoing edge list
+  // Index of edge in (CSR) outgoing edge array
   uint32_t index;
   // Destination device
   PDeviceId dest;
@@ -39,6 +43,103 @@ struct PEdgeDest {
   PDeviceAddr addr;
 };
 
+// A request for a local-multicast key, covering a run of edge
+// destinations (in a routing block) that share a mailbox
+struct PKeyRequest {
+  // Range of destinations in the routing block
+  uint32_t first, last;
+  // Destination mailbox
+  uint32_t mbox;
+  // Destination threads
+  uint32_t threadMaskLow;
+  uint32_t threadMaskHigh;
+  // Allocated key
+  // (Not valid until key allocation has been performed)
+  uint32_t key;
+
+  // Number of destination threads
+  inline uint32_t numThreads() {
+    return __builtin_popcount(threadMaskLow) +
+             __builtin_popcount(threadMaskHigh);
+  }
+};
+
+// Reference to a key request in a given routing block
+struct PKeyRequestRef {
+  uint32_t block;
+  uint32_t index;
+};
+
+// Hash table of key requests, used to find requests with identical
+// destinations
+struct PKeyRequestTable {
+  struct Entry {
+    uint64_t hash;
+    PKeyRequest* req;
+    PEdgeDest* dests;
+  };
+  Entry* entries;
+  uint32_t size;
+
+  PKeyRequestTable() { entries = NULL; size = 0; }
+  ~PKeyRequestTable() { if (entries) free(entries); }
+
+  // Empty the table, making room for given number of requests
+  void reset(uint32_t n) {
+    if (2*n > size) {
+      while (2*n > size) size = size == 0 ? 64 : 2*size;
+      if (entries) free(entries);
+      entries = (Entry*) malloc(size * sizeof(Entry));
+    }
+    memset(entries, 0, size * sizeof(Entry));
+  }
+
+  // Hash of the destinations of a request
+  static uint64_t hash(PKeyRequest* req, PEdgeDest* dests) {
+    uint64_t h = 0xcbf29ce484222325ul;
+    for (uint32_t i = req->first; i < req->last; i++) {
+      h ^= dests[i].addr;
+      h *= 0x100000001b3ul;
+    }
+    // Mix high bits into low bits, which index the table
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ul;
+    h ^= h >> 32;
+    return h;
+  }
+
+  // Find the entry for a request with the same destinations as the
+  // given one, or else the empty entry where it should be inserted
+  Entry* find(uint64_t h, PKeyRequest* req, PEdgeDest* dests) {
+    uint32_t n = req->last - req->first;
+    for (uint32_t i = (uint32_t) h & (size-1); ; i = (i+1) & (size-1)) {
+      Entry* e = &entries[i];
+      if (e->req == NULL) return e;
+      if (e->hash != h || e->req->last - e->req->first != n) continue;
+      bool same = true;
+      for (uint32_t j = 0; j < n && same; j++)
+        same = e->dests[e->req->first + j].addr == dests[req->first + j].addr;
+      if (same) return e;
+    }
+  }
+};
+
+// Routing tables are computed for blocks of consecutive devices.
+// Each block holds the sorted edge destinations of its devices, and
+// the key requests derived from them, in device and pin order.
+struct PRoutingBlock {
+  // Edge destinations, sorted by thread id for each (device, pin)
+  Seq<PEdgeDest>* dests;
+  // Key requests
+  Seq<PKeyRequest> requests;
+  // Number of requests for each (device, pin), local ones then
+  // non-local ones
+  Seq<uint32_t> numRequests;
+
+  PRoutingBlock() { dests = new Seq<PEdgeDest>; }
+  ~PRoutingBlock() { if (dests) delete dests; }
+};
+
 // Comparison function for PEdgeDest
 // (Useful to sort destinations by thread id of destination)
 inline int cmpEdgeDest(const void* e0, const void* e1) {
@@ -47,6 +148,13 @@ inline int cmpEdgeDest(const void* e0, const void* e1) {
   return getThreadId(d0->addr) < getThreadId(d1->addr);
 }
 
+// Comparison function for PDeviceId
+inline int cmpDeviceId(const void* d0, const void* d1) {
+  PDeviceId a = *(PDeviceId*) d0;
+  PDeviceId b = *(PDeviceId*) d1;
+  return a < b ? -1 : a > b;
+}
+
 // POETS graph
 template <typename DeviceType,
           typename S, typename E, typename M> class PGraph {
@@ -85,14 +193,13 @@ template <typename DeviceType,
   Seq<PInEdge<E>>** inTableRest;
   // Bitmap denoting used space in header table, for each thread
   Bitmap** inTableBitmaps;
+  // Arena holding the many small sequences of outTable; released in
+  // bulk by releaseAll()
+  SeqArena tableArena;
 
   // Programmable routing tables
   ProgRouterMesh* progRouterTables;
 
-  // Receiver groups (used internally by some methods, but declared once
-  // to avoid repeated allocation)
-  PReceiverGroup<E> groups[TinselThreadsPerMailbox];
-
   // Generic constructor
   void constructor(uint32_t lenX, uint32_t lenY) {
     meshLenX = lenX;
@@ -123,6 +230,7 @@ template <typename DeviceType,
     mapInEdgeHeadersToDRAM = true;
     mapInEdgeRestToDRAM = true;
     mapOutEdgesToDRAM = true;
+    autoRegionTiering = false;
     outTable = NULL;
     inTableHeaders = NULL;
     inTableRest = NULL;
@@ -133,6 +241,9 @@ template <typename DeviceType,
     if (str != NULL) {
       chatty = !strcmp(str, "0") ? 0 : 1;
     }
+    mapCacheDir = getenv("POLITE_MAP_CACHE");
+    str = getenv("POLITE_VERIFY");
+    verifyMapping = str != NULL && strcmp(str, "0") != 0;
   }
 
  public:
@@ -142,8 +253,9 @@ template <typename DeviceType,
   // Graph containing device ids and connections
   Graph graph;
 
-  // Edge labels: has same structure as graph.outgoing
-  Seq<Seq<E>*> edgeLabels;
+  // Edge labels: one per edge, in order of addition until the graph
+  // is frozen, and thereafter with same structure as graph.outNeighbours
+  Seq<E> edgeLabels;
 
   // Mapping from device id to device state
   // (Not valid until the mapper is called)
@@ -180,9 +292,25 @@ template <typename DeviceType,
   bool mapInEdgeRestToDRAM;
   bool mapOutEdgesToDRAM;
 
+  // Choose between SRAM and DRAM separately for each thread's regions,
+  // filling the thread's SRAM partition greedily with the regions
+  // accessed most often per byte: vertex states, in-edge headers,
+  // out-edges, and then remaining in-edges.  Regions that don't fit
+  // go to DRAM.  When set, the four flags above are ignored.
+  // (Off by default)
+  bool autoRegionTiering;
+
   // Allow mapper to print useful information to stdout
   uint32_t chatty;
 
+  // Directory in which to cache mapper results (NULL disables caching)
+  // (Initialised from the POLITE_MAP_CACHE environment variable)
+  const char* mapCacheDir;
+
+  // Call verifyRouting() at the end of the mapper, and exit on failure
+  // (Initialised from the POLITE_VERIFY environment variable)
+  bool verifyMapping;
+
   // Setter for number of boards to use
   void setNumBoards(uint32_t x, uint32_t y) {
     if (x > meshLenX || y > meshLenY) {
@@ -196,7 +324,6 @@ template <typename DeviceType,
 
   // Create new device
   inline PDeviceId newDevice() {
-    edgeLabels.append(new SmallSeq<E>);
     numDevices++;
     return graph.newNode();
   }
@@ -209,23 +336,22 @@ template <typename DeviceType,
     }
     graph.addEdge(from, pin, to);
     E edge;
-    edgeLabels.elems[from]->append(edge);
+    edgeLabels.append(edge);
   }
 
   // Add labelled edge using given output pin
   void addLabelledEdge(E edge, PDeviceId x, PinId pin, PDeviceId y) {
     graph.addEdge(x, pin, y);
-    edgeLabels.elems[x]->append(edge);
+    edgeLabels.append(edge);
   }
 
-  // Allocate SRAM and DRAM partitions
-  void allocatePartitions() {
-    // Decide a maximum partition size that is reasonable
-    // SRAM: Partition size minus 2048 bytes for the stack
-    uint32_t maxSRAMSize = (1<<TinselLogBytesPerSRAMPartition) - 2048;
-    // DRAM: Partition size minus 65536 bytes for the stack
-    uint32_t maxDRAMSize = (1<<TinselLogBytesPerDRAMPartition) - 65536;
-    // Allocate partition sizes and bases
+  // Convert graph and edge labels to CSR form
+  void freeze() {
+    graph.freeze(&edgeLabels);
+  }
+
+  // Allocate arrays holding each thread's partitions, sizes and bases
+  void allocatePartitionArrays() {
     vertexMem = (uint8_t**) calloc(TinselMaxThreads, sizeof(uint8_t*));
     vertexMemSize = (uint32_t*) calloc(TinselMaxThreads, sizeof(uint32_t));
     vertexMemBase = (uint32_t*) calloc(TinselMaxThreads, sizeof(uint32_t));
@@ -243,6 +369,69 @@ template <typename DeviceType,
     outEdgeMem = (uint8_t**) calloc(TinselMaxThreads, sizeof(uint8_t*));
     outEdgeMemSize = (uint32_t*) calloc(TinselMaxThreads, sizeof(uint32_t));
     outEdgeMemBase = (uint32_t*) calloc(TinselMaxThreads, sizeof(uint32_t));
+  }
+
+  // Decide a maximum partition size that is reasonable
+  // SRAM: Partition size minus 2048 bytes for the stack
+  inline uint32_t maxSRAMSize() {
+    return (1<<TinselLogBytesPerSRAMPartition) - 2048;
+  }
+  // DRAM: Partition size minus 65536 bytes for the stack
+  inline uint32_t maxDRAMSize() {
+    return (1<<TinselLogBytesPerDRAMPartition) - 65536;
+  }
+
+  // Estimate the SRAM and DRAM footprint of each device, for use as
+  // placer weights, along with the capacity of each thread.  The exact
+  // sizes are only known after routing, so these are upper bounds for
+  // the vertex and out-edge regions and an approximation for the
+  // in-edge regions (one header per device plus one edge per in-edge).
+  void deviceWeights(PlacerWeights* w) {
+    w->numConstraints = 2;
+    w->weights = (uint32_t*) calloc(2 * numDevices + 1, sizeof(uint32_t));
+    for (PDeviceId id = 0; id < numDevices; id++) {
+      uint32_t sizeV = sizeof(PState<S>) + sizeof(PLocalDeviceId);
+      uint32_t sizeEIHeader = sizeof(PInHeader<E>);
+      uint32_t sizeEIRest = graph.fanIn(id) * sizeof(PInEdge<E>);
+      uint32_t sizeEO = (graph.fanOut(id) + 2 * (graph.maxPin(id) + 1)) *
+                          sizeof(POutEdge);
+      uint32_t sram = 0, dram = 0;
+      if (autoRegionTiering) {
+        // Any region may spill to DRAM
+        w->weights[2*id+1] = sizeV + sizeEIHeader + sizeEIRest + sizeEO;
+        continue;
+      }
+      if (mapVerticesToDRAM) dram += sizeV; else sram += sizeV;
+      if (mapInEdgeHeadersToDRAM) dram += sizeEIHeader;
+                             else sram += sizeEIHeader;
+      if (mapInEdgeRestToDRAM) dram += sizeEIRest; else sram += sizeEIRest;
+      if (mapOutEdgesToDRAM) dram += sizeEO; else sram += sizeEO;
+      w->weights[2*id] = sram;
+      w->weights[2*id+1] = dram;
+    }
+    w->capacity[0] = maxSRAMSize() -
+      cacheAlign(sizeof(PThread<DeviceType, S, E, M>));
+    w->capacity[1] = maxDRAMSize();
+    if (autoRegionTiering) {
+      w->capacity[1] += w->capacity[0];
+      w->capacity[0] = 0;
+    }
+  }
+
+  // Place a region of given size in SRAM if it fits in the given free
+  // space, returning true if it must go in DRAM instead
+  bool spillRegion(uint32_t size, uint32_t* sramFree) {
+    if (size > *sramFree) return true;
+    *sramFree -= size;
+    return false;
+  }
+
+  // Allocate SRAM and DRAM partitions
+  void allocatePartitions() {
+    uint32_t maxSRAMSize = this->maxSRAMSize();
+    uint32_t maxDRAMSize = this->maxDRAMSize();
+    // Allocate partition sizes and bases
+    allocatePartitionArrays();
     // Compute partition sizes for each thread
     for (uint32_t threadId = 0; threadId < TinselMaxThreads; threadId++) {
       // This variable is used to count the size of the *initialised*
@@ -283,17 +472,30 @@ template <typename DeviceType,
       // The total partition size including uninitialised portions
       uint32_t totalSizeVMem =
         sizeVMem + wordAlign(sizeof(PLocalDeviceId) * numDevs);
+      // Decide where to map each region
+      bool vertsInDRAM = mapVerticesToDRAM;
+      bool headersInDRAM = mapInEdgeHeadersToDRAM;
+      bool restInDRAM = mapInEdgeRestToDRAM;
+      bool outInDRAM = mapOutEdgesToDRAM;
+      if (autoRegionTiering) {
+        uint32_t sramFree = sizeTMem < maxSRAMSize ?
+                              maxSRAMSize - sizeTMem : 0;
+        vertsInDRAM = spillRegion(totalSizeVMem, &sramFree);
+        headersInDRAM = spillRegion(sizeEIHeaderMem, &sramFree);
+        outInDRAM = spillRegion(sizeEOMem, &sramFree);
+        restInDRAM = spillRegion(sizeEIRestMem, &sramFree);
+      }
       // Check that total size is reasonable
       uint32_t totalSizeSRAM = sizeTMem;
       uint32_t totalSizeDRAM = 0;
-      if (mapVerticesToDRAM) totalSizeDRAM += totalSizeVMem;
-                        else totalSizeSRAM += totalSizeVMem;
-      if (mapInEdgeHeadersToDRAM) totalSizeDRAM += sizeEIHeaderMem;
-                             else totalSizeSRAM += sizeEIHeaderMem;
-      if (mapInEdgeRestToDRAM) totalSizeDRAM += sizeEIRestMem;
-                          else totalSizeSRAM += sizeEIRestMem;
-      if (mapOutEdgesToDRAM) totalSizeDRAM += sizeEOMem;
-                        else totalSizeSRAM += sizeEOMem;
+      if (vertsInDRAM) totalSizeDRAM += totalSizeVMem;
+                  else totalSizeSRAM += totalSizeVMem;
+      if (headersInDRAM) totalSizeDRAM += sizeEIHeaderMem;
+                    else totalSizeSRAM += sizeEIHeaderMem;
+      if (restInDRAM) totalSizeDRAM += sizeEIRestMem;
+                 else totalSizeSRAM += sizeEIRestMem;
+      if (outInDRAM) totalSizeDRAM += sizeEOMem;
+                else totalSizeSRAM += sizeEOMem;
       if (totalSizeDRAM > maxDRAMSize) {
         printf("Error: max DRAM partition size exceeded\n");
         exit(EXIT_FAILURE);
@@ -329,7 +531,7 @@ template <typename DeviceType,
       threadMemBase[threadId] = sramBase;
       sramBase += threadMemSize[threadId];
       // Determine base addresses of each region
-      if (mapVerticesToDRAM) {
+      if (vertsInDRAM) {
         vertexMemBase[threadId] = dramBase;
         dramBase += totalSizeVMem;
       }
@@ -337,7 +539,7 @@ template <typename DeviceType,
         vertexMemBase[threadId] = sramBase;
         sramBase += totalSizeVMem;
       }
-      if (mapInEdgeHeadersToDRAM) {
+      if (headersInDRAM) {
         inEdgeHeaderMemBase[threadId] = dramBase;
         dramBase += sizeEIHeaderMem;
       }
@@ -345,7 +547,7 @@ template <typename DeviceType,
         inEdgeHeaderMemBase[threadId] = sramBase;
         sramBase += sizeEIHeaderMem;
       }
-      if (mapInEdgeRestToDRAM) {
+      if (restInDRAM) {
         inEdgeRestMemBase[threadId] = dramBase;
         dramBase += sizeEIRestMem;
       }
@@ -353,7 +555,7 @@ template <typename DeviceType,
         inEdgeRestMemBase[threadId] = sramBase;
         sramBase += sizeEIRestMem;
       }
-      if (mapOutEdgesToDRAM) {
+      if (outInDRAM) {
         outEdgeMemBase[threadId] = dramBase;
         dramBase += sizeEOMem;
       }
@@ -443,6 +645,12 @@ template <typename DeviceType,
     numDevicesOnThread = (uint32_t*) calloc(TinselMaxThreads, sizeof(uint32_t));
   }
 
+  // Allocate a small sequence in the table arena
+  template <typename T> Seq<T>* newTableSeq() {
+    void* mem = tableArena.alloc(sizeof(SmallSeq<T>));
+    return new (mem) SmallSeq<T>(&tableArena);
+  }
+
   // Allocate routing tables
   // (Only valid after mapper is called)
   void allocateRoutingTables() {
@@ -473,15 +681,15 @@ template <typename DeviceType,
     outTable = (Seq<POutEdge>***) calloc(numDevices, sizeof(Seq<POutEdge>**));
     for (uint32_t d = 0; d < numDevices; d++) {
       outTable[d] = (Seq<POutEdge>**)
-        calloc(POLITE_NUM_PINS, sizeof(Seq<POutEdge>*));
+        tableArena.alloc(POLITE_NUM_PINS * sizeof(Seq<POutEdge>*));
       for (uint32_t p = 0; p < POLITE_NUM_PINS; p++)
-        outTable[d][p] = new SmallSeq<POutEdge>;
+        outTable[d][p] = newTableSeq<POutEdge>();
     }
   }
 
   // Determine local-multicast routing key for given set of receivers
   // (The key must be the same for all receivers)
-  uint32_t findKey(uint32_t numGroups) { 
+  uint32_t findKey(PReceiverGroup<E>* groups, uint32_t numGroups) {
     // Fast path (single receiver)
     if (numGroups == 1) {
       Bitmap* bm = inTableBitmaps[groups[0].threadId];
@@ -496,31 +704,43 @@ template <typename DeviceType,
       if (bm->firstFree > index) index = bm->firstFree;
     }
 
-    // Find key that is available for all receivers
-    uint64_t mask;
-    retry:
-      mask = 0ul;
-      for (uint32_t i = 0; i < numGroups; i++) {
-        PReceiverGroup<E>* g = &groups[i];
-        Bitmap* bm = inTableBitmaps[g->threadId];
-        mask |= bm->getWord(index);
-        if (~mask == 0ul) { index++; goto retry; }
+    // Find key that is available for all receivers.  The summary
+    // bitmaps give the words that are non-full in every receiver, 64
+    // words at a time; only those words need to be checked for a
+    // common free bit.
+    for (;;) {
+      uint32_t s = index >> 6;
+      uint64_t cand = ~0ul << (index & 63);
+      for (uint32_t i = 0; i < numGroups && cand != 0; i++) {
+        Bitmap* bm = inTableBitmaps[groups[i].threadId];
+        cand &= ~bm->getFullWord(s);
       }
-
-    // Mark key as taken in each bitmap
-    uint32_t bit = __builtin_ctzll(~mask);
-    for (uint32_t i = 0; i < numGroups; i++) {
-      PReceiverGroup<E>* g = &groups[i];
-      Bitmap* bm = inTableBitmaps[g->threadId];
-      bm->setBit(index, bit);
+      while (cand != 0) {
+        uint32_t w = 64*s + __builtin_ctzll(cand);
+        uint64_t mask = 0ul;
+        for (uint32_t i = 0; i < numGroups && ~mask != 0ul; i++) {
+          Bitmap* bm = inTableBitmaps[groups[i].threadId];
+          mask |= bm->getWord(w);
+        }
+        if (~mask != 0ul) {
+          // Mark key as taken in each bitmap
+          uint32_t bit = __builtin_ctzll(~mask);
+          for (uint32_t i = 0; i < numGroups; i++) {
+            Bitmap* bm = inTableBitmaps[groups[i].threadId];
+            bm->setBit(w, bit);
+          }
+          return 64*w + bit;
+        }
+        cand &= cand - 1;
+      }
+      index = 64*(s+1);
     }
-    return 64*index + bit;
   }
 
   // Add entries to the input tables for the given receivers
   // (Only valid after mapper is called)
-  uint32_t addInTableEntries(uint32_t numGroups) {
-    uint32_t key = findKey(numGroups);
+  uint32_t addInTableEntries(PReceiverGroup<E>* groups, uint32_t numGroups) {
+    uint32_t key = findKey(groups, numGroups);
     if (key >= 0xffff) {
       printf("Routing key exceeds 16 bits\n");
       exit(EXIT_FAILURE);
@@ -572,13 +792,13 @@ template <typename DeviceType,
     PDeviceAddr devAddr = toDeviceAddr[devId];
     uint32_t devBoard = getThreadId(devAddr) >> TinselLogThreadsPerBoard;
     // Split destinations into local/non-local
-    Seq<PDeviceId>* dests = graph.outgoing->elems[devId];
-    Seq<PinId>* pinIds = graph.pins->elems[devId];
-    for (uint32_t d = 0; d < dests->numElems; d++) {
-      if (pinIds->elems[d] == pinId) {
+    uint32_t first = graph.outOffsets[devId];
+    uint32_t last = graph.outOffsets[devId+1];
+    for (uint32_t d = first; d < last; d++) {
+      if (graph.outPins[d] == pinId) {
         PEdgeDest e;
         e.index = d;
-        e.dest = dests->elems[d];
+        e.dest = graph.outNeighbours[d];
         e.addr = toDeviceAddr[e.dest];
         uint32_t destBoard = getThreadId(e.addr) >> TinselLogThreadsPerBoard;
         if (devBoard == destBoard)
@@ -593,117 +813,300 @@ template <typename DeviceType,
     qsort(nonLocal->elems, nonLocal->numElems, sizeof(PEdgeDest), cmpEdgeDest);
   }
 
-  // Compute table updates for destinations for given device
-  // (Only valid after mapper is called)
-  void computeTables(Seq<PEdgeDest>* dests, uint32_t d,
-         Seq<PRoutingDest>* out) {
-    out->clear();
+  // Append destinations to the given routing block, along with a key
+  // request for each run of destinations on the same mailbox
+  // Returns the number of key requests added
+  uint32_t addKeyRequests(Seq<PEdgeDest>* dests, PRoutingBlock* block) {
+    uint32_t numRequests = 0;
+    uint32_t base = block->dests->numElems;
     uint32_t index = 0;
     while (index < dests->numElems) {
-      // New set of receiver groups on same mailbox
-      uint32_t threadMaskLow = 0;
-      uint32_t threadMaskHigh = 0;
-      uint32_t nextGroup = 0;
-      // Current mailbox & thread being considered
-      PDeviceAddr mbox = getThreadId(dests->elems[index].addr) >>
-                           TinselLogThreadsPerMailbox;
-      uint32_t thread = getThreadId(dests->elems[index].addr) &
-                          ((1<<TinselLogThreadsPerMailbox)-1);
-      // Determine edges targetting same mailbox
+      PKeyRequest req;
+      req.first = base + index;
+      req.mbox = getThreadId(dests->elems[index].addr) >>
+                   TinselLogThreadsPerMailbox;
+      req.threadMaskLow = req.threadMaskHigh = 0;
+      req.key = 0;
       while (index < dests->numElems) {
         PEdgeDest* edge = &dests->elems[index];
-        // Determine destination mailbox address and mailbox-local thread
-        uint32_t destMailbox = getThreadId(edge->addr) >>
-                                 TinselLogThreadsPerMailbox;
-        uint32_t destThread = getThreadId(edge->addr) &
-                                 ((1<<TinselLogThreadsPerMailbox)-1);
-        // Does destination match current destination?
-        if (destMailbox == mbox) {
-          if (destThread == thread) {
-            // Add to current receiver group
-            PInEdge<E> in;
-            in.devId = getLocalDeviceId(edge->addr);
-            Seq<E>* edges = edgeLabels.elems[d];
-            if (! std::is_same<E, None>::value)
-              in.edge = edges->elems[edge->index];
-            // Update current receiver group
-            groups[nextGroup].receivers.append(in);
-            groups[nextGroup].threadId = getThreadId(edge->addr);
-            if (thread < 32) threadMaskLow |= 1 << thread;
-            if (thread >= 32) threadMaskHigh |= 1 << (thread-32);
-            index++;
-          }
-          else {
-            // Start new receiver group
-            thread = destThread;
-            nextGroup++;
-            assert(nextGroup < TinselThreadsPerMailbox);
-          }
-        }
-        else break;
+        if ((getThreadId(edge->addr) >> TinselLogThreadsPerMailbox)
+              != req.mbox) break;
+        uint32_t thread = getThreadId(edge->addr) &
+                            ((1<<TinselLogThreadsPerMailbox)-1);
+        if (thread < 32) req.threadMaskLow |= 1 << thread;
+        if (thread >= 32) req.threadMaskHigh |= 1 << (thread-32);
+        block->dests->append(*edge);
+        index++;
       }
-      // Add input table entries
-      uint32_t key = addInTableEntries(nextGroup+1);
-      // Add output entry
-      PRoutingDest dest;
-      dest.kind = PRDestKindMRM;
-      dest.mbox = mbox;
-      dest.mrm.key = key;
-      dest.mrm.threadMaskLow = threadMaskLow;
-      dest.mrm.threadMaskHigh = threadMaskHigh;
-      out->append(dest);
-      // Clear receiver groups, for a new iteration
-      for (uint32_t i = 0; i <= nextGroup; i++) groups[i].receivers.clear();
+      req.last = base + index;
+      block->requests.append(req);
+      numRequests++;
     }
+    return numRequests;
+  }
+
+  // Allocate a key for the given request, and add entries to the
+  // input tables of the receivers.  The groups array is scratch space.
+  // (Only valid after mapper is called)
+  void allocKey(PKeyRequest* req, PEdgeDest* dests,
+                  PReceiverGroup<E>* groups) {
+    uint32_t nextGroup = 0;
+    // Current thread being considered
+    uint32_t thread = getThreadId(dests[req->first].addr) &
+                        ((1<<TinselLogThreadsPerMailbox)-1);
+    // Determine receiver groups
+    uint32_t index = req->first;
+    while (index < req->last) {
+      PEdgeDest* edge = &dests[index];
+      // Determine mailbox-local thread
+      uint32_t destThread = getThreadId(edge->addr) &
+                               ((1<<TinselLogThreadsPerMailbox)-1);
+      if (destThread == thread) {
+        // Add to current receiver group
+        PInEdge<E> in;
+        in.devId = getLocalDeviceId(edge->addr);
+        if (! std::is_same<E, None>::value)
+          in.edge = edgeLabels.elems[edge->index];
+        // Update current receiver group
+        groups[nextGroup].receivers.append(in);
+        groups[nextGroup].threadId = getThreadId(edge->addr);
+        index++;
+      }
+      else {
+        // Start new receiver group
+        thread = destThread;
+        nextGroup++;
+        assert(nextGroup < TinselThreadsPerMailbox);
+      }
+    }
+    // Add input table entries
+    req->key = addInTableEntries(groups, nextGroup+1);
+    // Clear receiver groups, for a new iteration
+    for (uint32_t i = 0; i <= nextGroup; i++) groups[i].receivers.clear();
   }
 
   // Compute routing tables
   // (Only valid after mapper is called)
+  //
+  // This is done in four phases:
+  //   1. Split and sort the destinations of each device, in parallel
+  //      over blocks of devices, producing key requests;
+  //   2. Bucket the key requests by destination mailbox;
+  //   3. Allocate keys, in parallel over destination mailboxes.  All
+  //      receivers of a key live on the same mailbox, so no two
+  //      workers touch the same bitmap or input table;
+  //   4. Fill in the sender-side and programmable router tables,
+  //      in device order.
+  // The result is independent of the number of worker threads.
   void computeRoutingTables() {
-    // Edge destinations (local to sender board, or not)
-    Seq<PEdgeDest> local;
-    Seq<PEdgeDest> nonLocal;
-
-    // Routing destinations
-    Seq<PRoutingDest> dests;
-
     // Allocate per-board programmable routing tables
     progRouterTables = new ProgRouterMesh(numBoardsX, numBoardsY);
 
-    // For each device
-    for (uint32_t d = 0; d < numDevices; d++) {
-      // For each pin
-      for (uint32_t p = 0; p < POLITE_NUM_PINS; p++) {
-        // Split edge lists into local/non-local and sort by target thread id
-        splitDests(d, p, &local, &nonLocal);
-        // Deal with board-local connections
-        computeTables(&local, d, &dests);
-        for (uint32_t i = 0; i < dests.numElems; i++) {
-          PRoutingDest dest = dests.elems[i];
+    // Divide devices into blocks
+    const uint32_t devicesPerBlock = 1024;
+    uint32_t numBlocks = (numDevices + devicesPerBlock - 1) / devicesPerBlock;
+    PRoutingBlock* blocks = new PRoutingBlock [numBlocks];
+
+    // Phase 1: split and sort destinations
+    #pragma omp parallel
+    {
+      // Edge destinations (local to sender board, or not)
+      Seq<PEdgeDest> local;
+      Seq<PEdgeDest> nonLocal;
+
+      #pragma omp for schedule(dynamic)
+      for (uint32_t b = 0; b < numBlocks; b++) {
+        PRoutingBlock* block = &blocks[b];
+        uint32_t first = b * devicesPerBlock;
+        uint32_t last = min(first + devicesPerBlock, numDevices);
+        for (uint32_t d = first; d < last; d++) {
+          for (uint32_t p = 0; p < POLITE_NUM_PINS; p++) {
+            // Split edge lists into local/non-local and sort by thread id
+            splitDests(d, p, &local, &nonLocal);
+            block->numRequests.append(addKeyRequests(&local, block));
+            block->numRequests.append(addKeyRequests(&nonLocal, block));
+          }
+        }
+      }
+    }
+
+    // Phase 2: bucket key requests by destination mailbox, and within
+    // each mailbox by decreasing number of destination threads
+    // (see phase 3)
+    const uint32_t numMailboxes = TinselMaxThreads >>
+                                    TinselLogThreadsPerMailbox;
+    const uint32_t numWidths = TinselThreadsPerMailbox + 1;
+    const uint32_t numBuckets = numMailboxes * numWidths;
+    uint32_t* bucketBase = (uint32_t*)
+      calloc(numBuckets+1, sizeof(uint32_t));
+    for (uint32_t b = 0; b < numBlocks; b++) {
+      Seq<PKeyRequest>* reqs = &blocks[b].requests;
+      for (uint32_t i = 0; i < reqs->numElems; i++) {
+        PKeyRequest* req = &reqs->elems[i];
+        uint32_t bucket = req->mbox * numWidths +
+                            TinselThreadsPerMailbox - req->numThreads();
+        bucketBase[bucket+1]++;
+      }
+    }
+    for (uint32_t k = 0; k < numBuckets; k++)
+      bucketBase[k+1] += bucketBase[k];
+    PKeyRequestRef* refs = (PKeyRequestRef*)
+      malloc((bucketBase[numBuckets]+1) * sizeof(PKeyRequestRef));
+    uint32_t* bucketNext = (uint32_t*) malloc(numBuckets * sizeof(uint32_t));
+    for (uint32_t k = 0; k < numBuckets; k++) bucketNext[k] = bucketBase[k];
+    for (uint32_t b = 0; b < numBlocks; b++) {
+      Seq<PKeyRequest>* reqs = &blocks[b].requests;
+      for (uint32_t i = 0; i < reqs->numElems; i++) {
+        PKeyRequest* req = &reqs->elems[i];
+        uint32_t bucket = req->mbox * numWidths +
+                            TinselThreadsPerMailbox - req->numThreads();
+        PKeyRequestRef* ref = &refs[bucketNext[bucket]++];
+        ref->block = b;
+        ref->index = i;
+      }
+    }
+    free(bucketNext);
+
+    // Phase 3: allocate keys
+    //
+    // Keys of requests that share a receiving thread must differ, and
+    // a thread's header table is as long as the largest key it
+    // receives.  Keys are therefore allocated lowest-first, as in a
+    // greedy colouring of the conflict graph of each mailbox, with
+    // the widest multicasts (the most constrained requests) going
+    // first.  Narrower requests then fill the gaps left behind,
+    // keeping header tables dense and keys small.
+    //
+    // When edges are unlabelled, requests with identical destinations
+    // share a key (and its input table entries).  This also lets the
+    // programmable routers share records between such requests.
+    const bool shareKeys = std::is_same<E, None>::value;
+    #pragma omp parallel
+    {
+      // Receiver groups (private to each worker)
+      PReceiverGroup<E>* groups =
+        new PReceiverGroup<E> [TinselThreadsPerMailbox];
+
+      // Requests allocated so far on the current mailbox
+      PKeyRequestTable allocated;
+
+      #pragma omp for schedule(dynamic)
+      for (uint32_t m = 0; m < numMailboxes; m++) {
+        uint32_t first = bucketBase[m * numWidths];
+        uint32_t last = bucketBase[(m+1) * numWidths];
+        if (shareKeys) allocated.reset(last - first);
+        for (uint32_t i = first; i < last; i++) {
+          PRoutingBlock* block = &blocks[refs[i].block];
+          PKeyRequest* req = &block->requests.elems[refs[i].index];
+          PEdgeDest* dests = block->dests->elems;
+          if (shareKeys) {
+            uint64_t h = PKeyRequestTable::hash(req, dests);
+            PKeyRequestTable::Entry* e = allocated.find(h, req, dests);
+            if (e->req != NULL) {
+              req->key = e->req->key;
+              continue;
+            }
+            e->hash = h;
+            e->req = req;
+            e->dests = dests;
+          }
+          allocKey(req, dests, groups);
+        }
+      }
+
+      delete [] groups;
+    }
+    free(bucketBase);
+    free(refs);
+
+    // Destinations are no longer needed
+    for (uint32_t b = 0; b < numBlocks; b++) {
+      delete blocks[b].dests;
+      blocks[b].dests = NULL;
+    }
+
+    // Phase 4: fill in sender-side and programmable router tables
+    //
+    // A remote destination with a single receiving thread uses a 48-bit
+    // URM1 record rather than a 96-bit MRM record.  URM1 overwrites the
+    // whole first word of the message with the key (MRM overwrites only
+    // the key's half-word), so it is only used when the message payload
+    // starts beyond the first word.
+    const bool useURM1 =
+      offsetof(PMessage<M>, payload) >= sizeof(uint32_t);
+
+    // Without shared keys, no two sequences of router records can be
+    // identical, so there is no point looking for them)
+    if (! shareKeys) progRouterTables->stopSharing();
+    Seq<PRoutingDest> dests;
+    for (uint32_t b = 0; b < numBlocks; b++) {
+      PRoutingBlock* block = &blocks[b];
+      uint32_t first = b * devicesPerBlock;
+      uint32_t last = min(first + devicesPerBlock, numDevices);
+      PKeyRequest* req = block->requests.elems;
+      uint32_t* numRequests = block->numRequests.elems;
+      for (uint32_t d = first; d < last; d++) {
+        for (uint32_t p = 0; p < POLITE_NUM_PINS; p++) {
+          // Deal with board-local connections
+          for (uint32_t i = 0; i < *numRequests; i++) {
+            POutEdge edge;
+            edge.mbox = req->mbox;
+            edge.key = req->key;
+            edge.threadMaskLow = req->threadMaskLow;
+            edge.threadMaskHigh = req->threadMaskHigh;
+            outTable[d][p]->append(edge);
+            req++;
+          }
+          numRequests++;
+          // Deal with non-board-local connections
+          dests.clear();
+          for (uint32_t i = 0; i < *numRequests; i++) {
+            PRoutingDest dest;
+            dest.mbox = req->mbox;
+            if (useURM1 && req->numThreads() == 1) {
+              dest.kind = PRDestKindURM1;
+              dest.urm1.threadId = req->threadMaskLow != 0 ?
+                __builtin_ctz(req->threadMaskLow) :
+                32 + __builtin_ctz(req->threadMaskHigh);
+              dest.urm1.key = req->key;
+            }
+            else {
+              dest.kind = PRDestKindMRM;
+              dest.mrm.key = req->key;
+              dest.mrm.threadMaskLow = req->threadMaskLow;
+              dest.mrm.threadMaskHigh = req->threadMaskHigh;
+            }
+            dests.append(dest);
+            req++;
+          }
+          numRequests++;
+          uint32_t src = getThreadId(toDeviceAddr[d]) >>
+            TinselLogThreadsPerMailbox;
+          uint32_t key = progRouterTables->addDestsFromBoard(src, &dests);
           POutEdge edge;
-          edge.mbox = dest.mbox;
-          edge.key = dest.mrm.key;
-          edge.threadMaskLow = dest.mrm.threadMaskLow;
-          edge.threadMaskHigh = dest.mrm.threadMaskHigh;
+          edge.mbox = tinselUseRoutingKey();
+          edge.key = 0;
+          edge.threadMaskLow = key;
+          edge.threadMaskHigh = 0; 
           outTable[d][p]->append(edge);
+          // Add output list terminator
+          POutEdge term;
+          term.key = InvalidKey;
+          outTable[d][p]->append(term);
         }
-        // Deal with non-board-local connections
-        computeTables(&nonLocal, d, &dests);
-        uint32_t src = getThreadId(toDeviceAddr[d]) >>
-          TinselLogThreadsPerMailbox;
-        uint32_t key = progRouterTables->addDestsFromBoard(src, &dests);
-        POutEdge edge;
-        edge.mbox = tinselUseRoutingKey();
-        edge.key = 0;
-        edge.threadMaskLow = key;
-        edge.threadMaskHigh = 0; 
-        outTable[d][p]->append(edge);
-        // Add output list terminator
-        POutEdge term;
-        term.key = InvalidKey;
-        outTable[d][p]->append(term);
       }
     }
+
+    delete [] blocks;
+
+    // Identical destination sets share programmable router records
+    if (chatty > 0) {
+      printf("POLite mapper: %lu bytes of router records shared\n",
+               progRouterTables->bytesShared());
+      printf("POLite mapper: %lu router visits per round of sends\n",
+               progRouterTables->numHops);
+    }
+    progRouterTables->stopSharing();
   }
 
   // Release all structures
@@ -740,6 +1143,7 @@ template <typename DeviceType,
       free(outEdgeMem);
       free(outEdgeMemSize);
       free(outEdgeMemBase);
+      devices = NULL;
     }
     if (inTableHeaders != NULL) {
       for (uint32_t t = 0; t < TinselMaxThreads; t++)
@@ -760,16 +1164,180 @@ template <typename DeviceType,
       inTableBitmaps = NULL;
     }
     if (outTable != NULL) {
-      for (uint32_t d = 0; d < numDevices; d++) {
-        if (outTable[d] == NULL) continue;
-        for (uint32_t p = 0; p < POLITE_NUM_PINS; p++)
-          delete outTable[d][p];
-        free(outTable[d]);
-      }
       free(outTable);
       outTable = NULL;
     }
+    tableArena.release();
     if (progRouterTables != NULL) delete progRouterTables;
+    progRouterTables = NULL;
+  }
+
+  // Hash of the graph and the mapper configuration
+  // (Used as the key for the mapping cache)
+  uint64_t mapHash() {
+    uint64_t h = PMapCacheVersion;
+    // Graph topology
+    h = mapCacheHashVal(h, graph.numNodes);
+    h = mapCacheHashVal(h, graph.numEdges);
+    h = mapCacheHash(h, graph.outOffsets,
+          (graph.numNodes+1) * sizeof(uint32_t));
+    h = mapCacheHash(h, graph.outNeighbours, graph.numEdges * sizeof(NodeId));
+    h = mapCacheHash(h, graph.outPins, graph.numEdges * sizeof(PinId));
+    // Edge labels
+    if (! std::is_same<E, None>::value)
+      h = mapCacheHash(h, edgeLabels.elems, edgeLabels.numElems * sizeof(E));
+    // Mapper configuration
+    h = mapCacheHashVal(h, numBoardsX);
+    h = mapCacheHashVal(h, numBoardsY);
+    h = mapCacheHashVal(h, mapVerticesToDRAM);
+    h = mapCacheHashVal(h, mapInEdgeHeadersToDRAM);
+    h = mapCacheHashVal(h, mapInEdgeRestToDRAM);
+    h = mapCacheHashVal(h, mapOutEdgesToDRAM);
+    h = mapCacheHashVal(h, autoRegionTiering);
+    h = mapCacheHashStr(h, getenv("POLITE_PLACER"));
+    h = mapCacheHashStr(h, getenv("POLITE_PLACER_TIME"));
+    h = mapCacheHashStr(h, getenv("POLITE_ROUTING"));
+    // Data structure layout
+    h = mapCacheHashVal(h, (uint32_t) POLITE_NUM_PINS);
+    h = mapCacheHashVal(h, (uint32_t) POLITE_EDGES_PER_HEADER);
+    h = mapCacheHashVal(h, (uint32_t) sizeof(PState<S>));
+    h = mapCacheHashVal(h, (uint32_t) sizeof(PInHeader<E>));
+    h = mapCacheHashVal(h, (uint32_t) sizeof(PInEdge<E>));
+    h = mapCacheHashVal(h, (uint32_t) sizeof(PThread<DeviceType, S, E, M>));
+    // Message layout (decides whether URM1 records may be used)
+    h = mapCacheHashVal(h, (uint32_t) offsetof(PMessage<M>, payload));
+    h = mapCacheHashVal(h, (uint32_t) sizeof(PMessage<M>));
+    h = mapCacheHashVal(h, (uint32_t) TinselMaxThreads);
+    h = mapCacheHashVal(h, (uint32_t) TinselPOLiteProgRouterBase);
+    return h;
+  }
+
+  // Name of mapping cache file for given hash (caller must free)
+  char* mapCacheFile(uint64_t hash) {
+    char* name = (char*) malloc(strlen(mapCacheDir) + 64);
+    sprintf(name, "%s/polite-%016lx.map", mapCacheDir, hash);
+    return name;
+  }
+
+  // Save mapping to the cache
+  // (Only valid immediately after mapper is called)
+  bool saveMapping(uint64_t hash) {
+    char* filename = mapCacheFile(hash);
+    PMapCacheWriter w(filename);
+    free(filename);
+    // Header
+    PMapCacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = PMapCacheMagic;
+    hdr.hash = hash;
+    hdr.version = PMapCacheVersion;
+    hdr.numDevices = numDevices;
+    hdr.numBoardsX = numBoardsX;
+    hdr.numBoardsY = numBoardsY;
+    hdr.maxThreads = TinselMaxThreads;
+    w.write(&hdr, sizeof(hdr));
+    // Mapping between device ids and device addresses
+    w.write(numDevicesOnThread, TinselMaxThreads * sizeof(uint32_t));
+    w.write(toDeviceAddr, numDevices * sizeof(PDeviceAddr));
+    for (uint32_t t = 0; t < TinselMaxThreads; t++)
+      w.write(fromDeviceAddr[t], numDevicesOnThread[t] * sizeof(PDeviceId));
+    // Heap images
+    uint8_t** mem[] = { vertexMem, threadMem, inEdgeHeaderMem,
+                        inEdgeRestMem, outEdgeMem };
+    uint32_t* size[] = { vertexMemSize, threadMemSize, inEdgeHeaderMemSize,
+                         inEdgeRestMemSize, outEdgeMemSize };
+    uint32_t* base[] = { vertexMemBase, threadMemBase, inEdgeHeaderMemBase,
+                         inEdgeRestMemBase, outEdgeMemBase };
+    for (uint32_t reg = 0; reg < 5; reg++) {
+      w.write(size[reg], TinselMaxThreads * sizeof(uint32_t));
+      w.write(base[reg], TinselMaxThreads * sizeof(uint32_t));
+      for (uint32_t t = 0; t < TinselMaxThreads; t++)
+        w.write(mem[reg][t], size[reg][t]);
+    }
+    // Programmable router tables
+    for (uint32_t y = 0; y < numBoardsY; y++)
+      for (uint32_t x = 0; x < numBoardsX; x++)
+        for (uint32_t i = 0; i < TinselDRAMsPerBoard; i++) {
+          Seq<uint8_t>* seq = progRouterTables->table[y][x].table[i];
+          uint32_t len = seq->numElems;
+          w.write(&len, sizeof(uint32_t));
+          w.write(seq->elems, len);
+        }
+    return w.commit();
+  }
+
+  // Load mapping from the cache, returning false if not present
+  // (On success, the result is as if the mapper had been called)
+  bool loadMapping(uint64_t hash) {
+    char* filename = mapCacheFile(hash);
+    PMapCacheReader r(filename);
+    free(filename);
+    if (! r.valid()) return false;
+    // Check header
+    PMapCacheHeader hdr;
+    if (! r.readInto(&hdr, sizeof(hdr))) return false;
+    if (hdr.magic != PMapCacheMagic || hdr.hash != hash ||
+        hdr.version != PMapCacheVersion || hdr.numDevices != numDevices ||
+        hdr.numBoardsX != numBoardsX || hdr.numBoardsY != numBoardsY ||
+        hdr.maxThreads != TinselMaxThreads) return false;
+    // Allocate all structures up front, so they can be released on error
+    allocateMapping();
+    allocatePartitionArrays();
+    progRouterTables = new ProgRouterMesh(numBoardsX, numBoardsY);
+    // Mapping between device ids and device addresses
+    r.readInto(numDevicesOnThread, TinselMaxThreads * sizeof(uint32_t));
+    r.readInto(toDeviceAddr, numDevices * sizeof(PDeviceAddr));
+    for (uint32_t t = 0; t < TinselMaxThreads && !r.overrun; t++) {
+      uint32_t numDevs = numDevicesOnThread[t];
+      if (numDevs == 0) continue;
+      fromDeviceAddr[t] = (PDeviceId*) malloc(sizeof(PDeviceId) * numDevs);
+      r.readInto(fromDeviceAddr[t], numDevs * sizeof(PDeviceId));
+    }
+    // Heap images
+    uint8_t** mem[] = { vertexMem, threadMem, inEdgeHeaderMem,
+                        inEdgeRestMem, outEdgeMem };
+    uint32_t* size[] = { vertexMemSize, threadMemSize, inEdgeHeaderMemSize,
+                         inEdgeRestMemSize, outEdgeMemSize };
+    uint32_t* base[] = { vertexMemBase, threadMemBase, inEdgeHeaderMemBase,
+                         inEdgeRestMemBase, outEdgeMemBase };
+    for (uint32_t reg = 0; reg < 5 && !r.overrun; reg++) {
+      r.readInto(size[reg], TinselMaxThreads * sizeof(uint32_t));
+      r.readInto(base[reg], TinselMaxThreads * sizeof(uint32_t));
+      for (uint32_t t = 0; t < TinselMaxThreads && !r.overrun; t++) {
+        mem[reg][t] = (uint8_t*) calloc(size[reg][t], 1);
+        r.readInto(mem[reg][t], size[reg][t]);
+      }
+    }
+    // Programmable router tables
+    for (uint32_t y = 0; y < numBoardsY; y++)
+      for (uint32_t x = 0; x < numBoardsX; x++)
+        for (uint32_t i = 0; i < TinselDRAMsPerBoard && !r.overrun; i++) {
+          Seq<uint8_t>* seq = progRouterTables->table[y][x].table[i];
+          uint32_t len = 0;
+          r.readInto(&len, sizeof(uint32_t));
+          seq->clear();
+          seq->ensureSpaceFor(len);
+          r.readInto(seq->elems, len);
+          seq->numElems = len;
+        }
+    // Check that the file was consistent
+    if (r.overrun) {
+      releaseAll();
+      return false;
+    }
+    // Device state pointers
+    for (uint32_t t = 0; t < TinselMaxThreads; t++) {
+      for (uint32_t devNum = 0; devNum < numDevicesOnThread[t]; devNum++) {
+        PDeviceId id = fromDeviceAddr[t][devNum];
+        if (id >= numDevices ||
+              (devNum+1) * sizeof(PState<S>) > vertexMemSize[t]) {
+          releaseAll();
+          return false;
+        }
+        devices[id] = (PState<S>*) &vertexMem[t][devNum * sizeof(PState<S>)];
+      }
+    }
+    return true;
   }
 
   // Implement mapping to tinsel threads
@@ -782,17 +1350,40 @@ template <typename DeviceType,
     // Release all mapping and heap structures
     releaseAll();
 
+    // Convert graph to CSR form
+    freeze();
+
+    // Try the mapping cache
+    uint64_t hash = 0;
+    if (mapCacheDir != NULL) {
+      hash = mapHash();
+      if (loadMapping(hash)) {
+        if (chatty > 0) printf("POLite mapper: loaded cached mapping\n");
+        if (verifyMapping && ! verifyRouting()) exit(EXIT_FAILURE);
+        return;
+      }
+    }
+
     // Reallocate mapping structures
     allocateMapping();
 
     // Start placement timer
     gettimeofday(&placementStart, NULL);
 
+    // Memory footprint of each device, and capacity of each thread
+    PlacerWeights threadWeights;
+    deviceWeights(&threadWeights);
+    PlacerWeights boxWeights =
+      threadWeights.scaled(1 << TinselLogThreadsPerMailbox);
+    PlacerWeights boardWeights =
+      threadWeights.scaled(1 << TinselLogThreadsPerBoard);
+
     // Partition into subgraphs, one per board
-    Placer boards(&graph, numBoardsX, numBoardsY);
+    Placer boards(&graph, numBoardsX, numBoardsY, &boardWeights);
 
     // Place subgraphs onto 2D mesh
-    const uint32_t placerEffort = 8;
+    // (Each attempt anneals, so a couple of attempts suffice)
+    const uint32_t placerEffort = 2;
     boards.place(placerEffort);
 
     // For each board
@@ -801,8 +1392,8 @@ template <typename DeviceType,
       for (uint32_t boardX = 0; boardX < numBoardsX; boardX++) {
         // Partition into subgraphs, one per mailbox
         PartitionId b = boards.mapping[boardY][boardX];
-        Placer boxes(&boards.subgraphs[b], 
-                 TinselMailboxMeshXLen, TinselMailboxMeshYLen);
+        Placer boxes(&boards.subgraphs[b],
+                 TinselMailboxMeshXLen, TinselMailboxMeshYLen, &boxWeights);
         boxes.place(placerEffort);
 
         // For each mailbox
@@ -811,7 +1402,8 @@ template <typename DeviceType,
             // Partition into subgraphs, one per thread
             uint32_t numThreads = 1<<TinselLogThreadsPerMailbox;
             PartitionId t = boxes.mapping[boxY][boxX];
-            Placer threads(&boxes.subgraphs[t], numThreads, 1);
+            Placer threads(&boxes.subgraphs[t], numThreads, 1,
+                             &threadWeights);
 
             // For each thread
             for (uint32_t threadNum = 0; threadNum < numThreads; threadNum++) {
@@ -827,7 +1419,7 @@ template <typename DeviceType,
               Graph* g = &threads.subgraphs[threadNum];
 
               // Populate fromDeviceAddr mapping
-              uint32_t numDevs = g->incoming->numElems;
+              uint32_t numDevs = g->numNodes;
               numDevicesOnThread[threadId] = numDevs;
               fromDeviceAddr[threadId] = (PDeviceId*)
                 malloc(sizeof(PDeviceId) * numDevs);
@@ -847,6 +1439,9 @@ template <typename DeviceType,
       }
     }
 
+    // Release device weights
+    free(threadWeights.weights);
+
     // Stop placement timer and start routing timer
     gettimeofday(&placementFinish, NULL);
     gettimeofday(&routingStart, NULL);
@@ -863,6 +1458,11 @@ template <typename DeviceType,
     allocatePartitions();
     initialisePartitions();
 
+    // Populate the mapping cache
+    if (mapCacheDir != NULL && ! saveMapping(hash)) {
+      if (chatty > 0) printf("POLite mapper: unable to save mapping\n");
+    }
+
     // Display times, if chatty
     gettimeofday(&initFinish, NULL);
     if (chatty > 0) {
@@ -882,6 +1482,146 @@ template <typename DeviceType,
       duration = (double) diff.tv_sec + (double) diff.tv_usec / 1000000.0;
       printf("  Thread state initialisation: %lfs\n", duration);
     }
+
+    // Check the mapping, if requested
+    if (verifyMapping && ! verifyRouting()) exit(EXIT_FAILURE);
+  }
+
+  // Check that the mapping delivers every edge exactly once, by
+  // decoding the heap images and programmable router tables that would
+  // be written to the hardware, and simulating the routers (see
+  // ProgRouterSim.h).  Edge labels are not checked.  Prints the first
+  // few errors found, along with the DRAM beats fetched and inter-board
+  // hops taken per routing key.  Returns true if no errors are found.
+  // (Only valid after the mapper is called)
+  bool verifyRouting() {
+    const uint32_t maxReports = 10;
+    uint64_t numErrors = 0, numSends = 0, totalBeats = 0, totalHops = 0;
+    uint32_t maxBeats = 0, maxHops = 0;
+    #pragma omp parallel reduction(+: numErrors, numSends, totalBeats, \
+                                      totalHops) \
+                         reduction(max: maxBeats, maxHops)
+    {
+      ProgRouterSim sim(progRouterTables, numBoardsX, numBoardsY);
+      Seq<PRoutingDelivery> deliveries;
+      Seq<PDeviceId> expected, received;
+      #pragma omp for schedule(dynamic, 256)
+      for (uint32_t d = 0; d < numDevices; d++) {
+        PThreadId src = getThreadId(toDeviceAddr[d]);
+        uint32_t srcX = destX(src >> TinselLogThreadsPerMailbox);
+        uint32_t srcY = destY(src >> TinselLogThreadsPerMailbox);
+        POutEdge* outEdges = (POutEdge*) outEdgeMem[src];
+        uint32_t numOutEdges = outEdgeMemSize[src] / sizeof(POutEdge);
+        for (uint32_t p = 0; p < POLITE_NUM_PINS; p++) {
+          const char* error = NULL;
+          // Determine destination threads and keys
+          deliveries.clear();
+          for (uint32_t i = devices[d]->pinBase[p]; ; i++) {
+            if (i >= numOutEdges) {
+              error = "out-edge list not terminated";
+              break;
+            }
+            POutEdge* e = &outEdges[i];
+            if (e->key == InvalidKey) break;
+            if (e->mbox == tinselUseRoutingKey()) {
+              uint32_t beats, hops;
+              if (! sim.simulate(srcX, srcY, e->threadMaskLow,
+                                   &deliveries, &beats, &hops)) {
+                error = sim.error;
+                break;
+              }
+              numSends++;
+              totalBeats += beats;
+              totalHops += hops;
+              if (beats > maxBeats) maxBeats = beats;
+              if (hops > maxHops) maxHops = hops;
+            }
+            else {
+              for (uint32_t t = 0; t < 64; t++) {
+                uint32_t mask = t < 32 ? e->threadMaskLow : e->threadMaskHigh;
+                if ((mask >> (t & 31)) & 1)
+                  deliveries.append({
+                    ((uint32_t) e->mbox << TinselLogThreadsPerMailbox) + t,
+                    e->key});
+              }
+            }
+          }
+          // Determine receiving devices
+          received.clear();
+          for (uint32_t i = 0;
+                 i < (uint32_t) deliveries.numElems && !error; i++) {
+            uint32_t t = deliveries.elems[i].threadId;
+            uint16_t key = deliveries.elems[i].key;
+            if (t >= TinselMaxThreads || numDevicesOnThread[t] == 0) {
+              error = "message delivered to thread with no devices";
+              break;
+            }
+            PInHeader<E>* header = (PInHeader<E>*) inEdgeHeaderMem[t];
+            PInEdge<E>* rest = (PInEdge<E>*) inEdgeRestMem[t];
+            uint32_t numRest = inEdgeRestMemSize[t] / sizeof(PInEdge<E>);
+            if (key >= inEdgeHeaderMemSize[t] / sizeof(PInHeader<E>)) {
+              error = "in-table key out of range";
+              break;
+            }
+            header += key;
+            if (header->numReceivers == 0) {
+              error = "message delivered to key with no receivers";
+              break;
+            }
+            for (uint32_t j = 0; j < header->numReceivers; j++) {
+              PInEdge<E>* edge = &header->edges[j];
+              if (j >= POLITE_EDGES_PER_HEADER) {
+                uint32_t index = header->restIndex +
+                                   j - POLITE_EDGES_PER_HEADER;
+                if (index >= numRest) {
+                  error = "in-table edge index out of range";
+                  break;
+                }
+                edge = &rest[index];
+              }
+              if (edge->devId >= numDevicesOnThread[t]) {
+                error = "in-table device id out of range";
+                break;
+              }
+              received.append(fromDeviceAddr[t][edge->devId]);
+            }
+          }
+          // Compare with the edges in the graph
+          if (! error) {
+            expected.clear();
+            for (uint32_t i = graph.outOffsets[d];
+                   i < graph.outOffsets[d+1]; i++)
+              if (graph.outPins[i] == (PinId) p)
+                expected.append(graph.outNeighbours[i]);
+            qsort(expected.elems, expected.numElems, sizeof(PDeviceId),
+                    cmpDeviceId);
+            qsort(received.elems, received.numElems, sizeof(PDeviceId),
+                    cmpDeviceId);
+            if (expected.numElems != received.numElems ||
+                  memcmp(expected.elems, received.elems,
+                    expected.numElems * sizeof(PDeviceId)) != 0)
+              error = "edges not delivered exactly once";
+          }
+          if (error) {
+            #pragma omp critical
+            {
+              if (numErrors < maxReports)
+                fprintf(stderr, "POLite verifier: device %u pin %u: %s\n",
+                  d, p, error);
+            }
+            numErrors++;
+          }
+        }
+      }
+    }
+    printf("POLite verifier: %lu routing keys, DRAM beats fetched "
+           "per key: %.2lf (max %u), inter-board hops per key: "
+           "%.2lf (max %u)\n", numSends,
+           numSends ? (double) totalBeats / numSends : 0.0, maxBeats,
+           numSends ? (double) totalHops / numSends : 0.0, maxHops);
+    if (numErrors > 0)
+      fprintf(stderr, "POLite verifier: %lu errors\n", numErrors);
+    return numErrors == 0;
   }
 
   // Constructor
@@ -903,8 +1643,16 @@ template <typename DeviceType,
   // Deconstructor
   ~PGraph() {
     releaseAll();
-    for (uint32_t i = 0; i < edgeLabels.numElems; i++)
-      delete edgeLabels.elems[i];
+  }
+
+  // Runs of at least this many zero words are uploaded using ZeroCmd
+  static const uint32_t minZeroRun = 8;
+
+  // Number of zero words at the start of given array of n words
+  static uint32_t zeroRun(uint32_t* words, uint32_t n) {
+    uint32_t i = 0;
+    while (i < n && words[i] == 0) i++;
+    return i;
   }
 
   // Write partition to tinsel machine
@@ -949,9 +1697,25 @@ template <typename DeviceType,
                   hostLink->setAddr(x, y, c,
                     heapBase[hostLink->toAddr(x, y, c, t+1)]);
               } else {
-                uint32_t send = min((heapSize[threadId] - written)>>2, 15);
-                hostLink->store(x, y, c, send,
-                  (uint32_t*) &heap[threadId][written]);
+                // Runs of zero words are written using a single
+                // ZeroCmd, and stores stop short of such runs
+                uint32_t* words = (uint32_t*) &heap[threadId][written];
+                uint32_t remaining = (heapSize[threadId] - written) >> 2;
+                uint32_t zeros = zeroRun(words, remaining);
+                uint32_t send = min(remaining, 15);
+                if (zeros >= minZeroRun || zeros == remaining) {
+                  send = zeros;
+                  hostLink->zero(x, y, c, send);
+                }
+                else {
+                  for (uint32_t i = 1; i < send; i++)
+                    if (words[i] == 0 &&
+                          zeroRun(&words[i], remaining-i) >= minZeroRun) {
+                      send = i;
+                      break;
+                    }
+                  hostLink->store(x, y, c, send, words);
+                }
                 writeCount[threadId] = written + send * sizeof(uint32_t);
               }
             }
@@ -1001,11 +1765,13 @@ template <typename DeviceType,
 
   // Determine fan-in of given device
   uint32_t fanIn(PDeviceId id) {
+    freeze();
     return graph.fanIn(id);
   }
 
   // Determine fan-out of given device
   uint32_t fanOut(PDeviceId id) {
+    freeze();
     return graph.fanOut(id);
   }
 };
@@ -3,6 +3,8 @@
 #define _PLACER_H_
 
 #include <stdint.h>
+#include <math.h>
+#include <sys/time.h>
 #include <metis.h>
 #include <POLite/Graph.h>
 #include <queue>
@@ -10,6 +12,28 @@
 
 typedef uint32_t PartitionId;
 
+// Maximum number of weight constraints per node
+#define PlacerMaxConstraints 2
+
+// Optional node weights, used to keep the total weight of each
+// partition within a given capacity (e.g. bytes of memory)
+struct PlacerWeights {
+  // Number of constraints per node
+  uint32_t numConstraints;
+  // Weights indexed by node label: weights[label*numConstraints + c]
+  uint32_t* weights;
+  // Max total weight of each partition, per constraint (0 = unbounded)
+  uint64_t capacity[PlacerMaxConstraints];
+
+  // Copy of these weights with capacities multiplied by given factor
+  PlacerWeights scaled(uint32_t factor) {
+    PlacerWeights w = *this;
+    for (uint32_t c = 0; c < numConstraints; c++)
+      w.capacity[c] *= factor;
+    return w;
+  }
+};
+
 // Partition and place a graph on a 2D mesh
 struct Placer {
   // Select between different methods
@@ -28,6 +52,10 @@ struct Placer {
   // Dimension of the 2D mesh
   uint32_t width, height;
 
+  // Node weights and partition capacities (NULL if unweighted)
+  // (Only used during construction)
+  PlacerWeights* weights;
+
   // Mapping from node id to partition id
   PartitionId* partitions;
 
@@ -57,6 +85,12 @@ struct Placer {
   unsigned int seed;
   void setRand(unsigned int s) { seed = s; };
   int getRand() { return rand_r(&seed); }
+  double getRandUnit() { return (double) getRand() / (double) RAND_MAX; }
+
+  // Optional time budget for each call to place(), in seconds, or
+  // zero for none (initialised from the POLITE_PLACER_TIME environment
+  // variable).  Without a budget, placement is deterministic.
+  double timeBudget;
 
   // Controls which strategy is used
   Method method = Default;
@@ -85,17 +119,44 @@ struct Placer {
       method = defaultMethod;
   }
 
+  // Weight of given node under given constraint
+  inline uint32_t weight(NodeId i, uint32_t c) {
+    NodeLabel label = graph->labels->elems[i];
+    return weights->weights[label*weights->numConstraints + c];
+  }
+
+  // Build the Metis vertex weight array, setting the number of
+  // constraints.  Constraints with zero total weight are dropped, and
+  // the rest are scaled down so that totals fit comfortably in idx_t.
+  idx_t* metisWeights(idx_t* ncon) {
+    uint32_t numNodes = graph->numNodes;
+    uint32_t used[PlacerMaxConstraints];
+    uint32_t shift[PlacerMaxConstraints];
+    uint32_t n = 0;
+    for (uint32_t c = 0; c < weights->numConstraints; c++) {
+      uint64_t total = 0;
+      for (uint32_t i = 0; i < numNodes; i++) total += weight(i, c);
+      if (total == 0) continue;
+      shift[n] = 0;
+      while ((total >> shift[n]) >= (1ul << 30)) shift[n]++;
+      used[n++] = c;
+    }
+    *ncon = n > 0 ? n : 1;
+    if (n == 0) return NULL;
+    idx_t* vwgt = (idx_t*) calloc(numNodes * n, sizeof(idx_t));
+    for (uint32_t i = 0; i < numNodes; i++)
+      for (uint32_t j = 0; j < n; j++)
+        vwgt[i*n + j] = (idx_t) (weight(i, used[j]) >> shift[j]);
+    return vwgt;
+  }
+
   // Partition the graph using Metis
   void partitionMetis() {
     // Compute total number of edges
-    uint32_t numEdges = 0;
-    for (uint32_t i = 0; i < graph->incoming->numElems; i++) {
-      numEdges += graph->incoming->elems[i]->numElems +
-                  graph->outgoing->elems[i]->numElems;
-    }
+    uint32_t numEdges = 2 * graph->numEdges;
 
     // Create Metis parameters
-    idx_t nvtxs = (idx_t) graph->incoming->numElems;
+    idx_t nvtxs = (idx_t) graph->numNodes;
     idx_t nparts = (idx_t) (width * height);
     idx_t nconn = 1;
     idx_t objval;
@@ -125,16 +186,25 @@ struct Placer {
     uint32_t next = 0;
     for (uint32_t i = 0; i < nvtxs; i++) {
       xadj[i] = next;
-      Seq<NodeId>* in = graph->incoming->elems[i];
-      Seq<NodeId>* out = graph->outgoing->elems[i];
-      for (uint32_t j = 0; j < in->numElems; j++)
-        adjncy[next++] = (idx_t) in->elems[j];
-      for (uint32_t j = 0; j < out->numElems; j++)
-        if (! in->member(out->elems[j]))
-          adjncy[next++] = (idx_t) out->elems[j];
+      NodeId* in = graph->incoming(i);
+      NodeId* out = graph->outgoing(i);
+      uint32_t numIn = graph->fanIn(i);
+      uint32_t numOut = graph->fanOut(i);
+      for (uint32_t j = 0; j < numIn; j++)
+        adjncy[next++] = (idx_t) in[j];
+      for (uint32_t j = 0; j < numOut; j++) {
+        bool member = false;
+        for (uint32_t k = 0; k < numIn; k++)
+          if (in[k] == out[j]) { member = true; break; }
+        if (! member) adjncy[next++] = (idx_t) out[j];
+      }
     }
     xadj[nvtxs] = (idx_t) next;
 
+    // Vertex weights, if any
+    idx_t* vwgt = NULL;
+    if (weights != NULL) vwgt = metisWeights(&nconn);
+
     // Allocate Metis result array
     idx_t* parts = (idx_t*) calloc(nvtxs, sizeof(idx_t));
 
@@ -148,21 +218,22 @@ struct Placer {
     // METIS_PartGraphRecursive.
     int ret = METIS_PartGraphRecursive(
       &nvtxs, &nconn, xadj, adjncy,
-      NULL, NULL, NULL, &nparts, NULL, NULL, options, &objval, parts);
+      vwgt, NULL, NULL, &nparts, NULL, NULL, options, &objval, parts);
 
     // Populate result array
-    for (uint32_t i = 0; i < graph->incoming->numElems; i++)
+    for (uint32_t i = 0; i < graph->numNodes; i++)
       partitions[i] = (uint32_t) parts[i];
 
     // Release Metis structures
     free(xadj);
     free(adjncy);
     free(parts);
+    free(vwgt);
   }
 
   // Partition the graph randomly
   void partitionRandom() {
-    uint32_t numVertices = graph->incoming->numElems;
+    uint32_t numVertices = graph->numNodes;
     uint32_t numParts = width * height;
 
     // Populate result array
@@ -173,7 +244,7 @@ struct Placer {
 
   // Partition the graph using direct mapping
   void partitionDirect() {
-    uint32_t numVertices = graph->incoming->numElems;
+    uint32_t numVertices = graph->numNodes;
     uint32_t numParts = width * height;
     uint32_t partSize = (numVertices + numParts) / numParts;
 
@@ -185,7 +256,7 @@ struct Placer {
 
   // Partition the graph using repeated BFS
   void partitionBFS() {
-    uint32_t numVertices = graph->incoming->numElems;
+    uint32_t numVertices = graph->numNodes;
     uint32_t numParts = width * height;
     uint32_t partSize = (numVertices + numParts) / numParts;
 
@@ -215,9 +286,10 @@ struct Placer {
             partitions[v] = nextPart;
             count++;
             // Add unvisited neighbours of v to the frontier
-            Seq<uint32_t>* dests = graph->outgoing->elems[v];
-            for (uint32_t i = 0; i < dests->numElems; i++) {
-              uint32_t w = dests->elems[i];
+            NodeId* dests = graph->outgoing(v);
+            uint32_t numDests = graph->fanOut(v);
+            for (uint32_t i = 0; i < numDests; i++) {
+              uint32_t w = dests[i];
               if (!seen[w]) frontier.push(w);
             }
           }
@@ -250,15 +322,106 @@ struct Placer {
     }
   }
 
+  // Does the given partition exceed its capacity?
+  // (The load array holds the total weight of each partition)
+  bool overfull(uint64_t* load, PartitionId p) {
+    uint32_t nc = weights->numConstraints;
+    for (uint32_t c = 0; c < nc; c++) {
+      uint64_t cap = weights->capacity[c];
+      if (cap != 0 && load[p*nc + c] > cap) return true;
+    }
+    return false;
+  }
+
+  // Is there room for the given node in the given partition?
+  bool fits(uint64_t* load, PartitionId p, NodeId i) {
+    uint32_t nc = weights->numConstraints;
+    for (uint32_t c = 0; c < nc; c++) {
+      uint64_t cap = weights->capacity[c];
+      if (cap != 0 && load[p*nc + c] + weight(i, c) > cap) return false;
+    }
+    return true;
+  }
+
+  // Fraction of capacity used by the fullest constraint of a partition
+  double fullness(uint64_t* load, PartitionId p) {
+    uint32_t nc = weights->numConstraints;
+    double max = 0;
+    for (uint32_t c = 0; c < nc; c++) {
+      uint64_t cap = weights->capacity[c];
+      if (cap == 0) continue;
+      double f = (double) load[p*nc + c] / (double) cap;
+      if (f > max) max = f;
+    }
+    return max;
+  }
+
+  // Move nodes out of partitions that exceed their capacity.  Each node
+  // in an overfull partition is moved to the partition, with room for
+  // it, holding most of its neighbours (the least full on a tie).
+  // Nodes too heavy for any partition are left where they are.
+  void balance() {
+    if (weights == NULL) return;
+    uint32_t numPartitions = width*height;
+    uint32_t nc = weights->numConstraints;
+
+    // Compute load of each partition
+    uint64_t* load = new uint64_t [numPartitions*nc];
+    for (uint32_t i = 0; i < numPartitions*nc; i++) load[i] = 0;
+    for (uint32_t i = 0; i < graph->numNodes; i++)
+      for (uint32_t c = 0; c < nc; c++)
+        load[partitions[i]*nc + c] += weight(i, c);
+
+    // Number of neighbours of current node in each partition
+    uint32_t* adj = new uint32_t [numPartitions];
+    for (uint32_t p = 0; p < numPartitions; p++) adj[p] = 0;
+
+    for (uint32_t i = 0; i < graph->numNodes; i++) {
+      PartitionId p = partitions[i];
+      if (! overfull(load, p)) continue;
+      // Count neighbours in each partition
+      NodeId* in = graph->incoming(i);
+      NodeId* out = graph->outgoing(i);
+      uint32_t numIn = graph->fanIn(i);
+      uint32_t numOut = graph->fanOut(i);
+      for (uint32_t j = 0; j < numIn; j++) adj[partitions[in[j]]]++;
+      for (uint32_t j = 0; j < numOut; j++) adj[partitions[out[j]]]++;
+      // Choose destination
+      PartitionId best = p;
+      double bestFullness = 0;
+      for (PartitionId q = 0; q < numPartitions; q++) {
+        if (q == p || ! fits(load, q, i)) continue;
+        double f = fullness(load, q);
+        if (best == p || adj[q] > adj[best] ||
+              (adj[q] == adj[best] && f < bestFullness)) {
+          best = q;
+          bestFullness = f;
+        }
+      }
+      for (uint32_t q = 0; q < numPartitions; q++) adj[q] = 0;
+      // Move node
+      if (best != p) {
+        for (uint32_t c = 0; c < nc; c++) {
+          load[p*nc + c] -= weight(i, c);
+          load[best*nc + c] += weight(i, c);
+        }
+        partitions[i] = best;
+      }
+    }
+
+    delete [] load;
+    delete [] adj;
+  }
+
   // Create subgraph for each partition
   void computeSubgraphs() {
     uint32_t numPartitions = width*height;
 
     // Create mapping from node id to subgraph node id
-    NodeId* mappedTo = new NodeId [graph->incoming->numElems];
+    NodeId* mappedTo = new NodeId [graph->numNodes];
 
     // Create subgraphs
-    for (uint32_t i = 0; i < graph->incoming->numElems; i++) {
+    for (uint32_t i = 0; i < graph->numNodes; i++) {
       // What parition is this node in?
       PartitionId p = partitions[i];
       // Add node to subgraph
@@ -268,16 +431,21 @@ struct Placer {
     }
 
     // Add edges to subgraphs
-    for (uint32_t i = 0; i < graph->incoming->numElems; i++) {
+    for (uint32_t i = 0; i < graph->numNodes; i++) {
       PartitionId p = partitions[i];
-      Seq<NodeId>* out = graph->outgoing->elems[i];
-      for (uint32_t j = 0; j < out->numElems; j++) {
-        NodeId neighbour = out->elems[j];
+      NodeId* out = graph->outgoing(i);
+      uint32_t numOut = graph->fanOut(i);
+      for (uint32_t j = 0; j < numOut; j++) {
+        NodeId neighbour = out[j];
         if (partitions[neighbour] == p)
           subgraphs[p].addEdge(mappedTo[i], mappedTo[neighbour]);
       }
     }
 
+    // Convert subgraphs to CSR form
+    for (uint32_t p = 0; p < numPartitions; p++)
+      subgraphs[p].freeze();
+
     // Release mapping
     delete [] mappedTo;
   }
@@ -292,13 +460,15 @@ struct Placer {
         connCount[i][j] = 0;
 
     // Iterative over graph and count connections
-    for (uint32_t i = 0; i < graph->incoming->numElems; i++) {
-      Seq<NodeId>* in = graph->incoming->elems[i];
-      Seq<NodeId>* out = graph->outgoing->elems[i];
-      for (uint32_t j = 0; j < in->numElems; j++)
-        connCount[partitions[i]][partitions[in->elems[j]]]++;
-      for (uint32_t j = 0; j < out->numElems; j++)
-        connCount[partitions[i]][partitions[out->elems[j]]]++;
+    for (uint32_t i = 0; i < graph->numNodes; i++) {
+      NodeId* in = graph->incoming(i);
+      NodeId* out = graph->outgoing(i);
+      uint32_t numIn = graph->fanIn(i);
+      uint32_t numOut = graph->fanOut(i);
+      for (uint32_t j = 0; j < numIn; j++)
+        connCount[partitions[i]][partitions[in[j]]]++;
+      for (uint32_t j = 0; j < numOut; j++)
+        connCount[partitions[i]][partitions[out[j]]]++;
     }
   }
 
@@ -365,6 +535,34 @@ struct Placer {
     return total;
   }
 
+  // Manhattan distance between two mesh nodes
+  inline int64_t dist(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    uint32_t xDist = x0 >= x1 ? x0 - x1 : x1 - x0;
+    uint32_t yDist = y0 >= y1 ? y0 - y1 : y1 - y0;
+    return (int64_t) (xDist + yDist);
+  }
+
+  // Connection count between two partitions, as used by the cost function
+  inline int64_t conn(PartitionId i, PartitionId j) {
+    return (int64_t) (i > j ? connCount[i][j] : connCount[j][i]);
+  }
+
+  // Change in cost that would result from swapping two mesh nodes
+  // Only the distances to the other partitions change, so this is O(P)
+  int64_t swapDelta(uint32_t x, uint32_t y, uint32_t xNew, uint32_t yNew) {
+    PartitionId p = mapping[y][x];
+    PartitionId q = mapping[yNew][xNew];
+    uint32_t numPartitions = width*height;
+    int64_t delta = 0;
+    for (uint32_t k = 0; k < numPartitions; k++) {
+      if (k == p || k == q) continue;
+      int64_t d = dist(xNew, yNew, xCoord[k], yCoord[k]) -
+                    dist(x, y, xCoord[k], yCoord[k]);
+      delta += d * (conn(p, k) - conn(q, k));
+    }
+    return delta;
+  }
+
   // Swap two mesh nodes
   inline void swap(uint32_t x, uint32_t y, uint32_t xNew, uint32_t yNew) {
     PartitionId p = mapping[y][x];
@@ -379,22 +577,89 @@ struct Placer {
 
   // Swap two mesh nodes only if cost is reduced
   bool trySwap(uint32_t x, uint32_t y, uint32_t xNew, uint32_t yNew) {
-    // Try swap
-    swap(x, y, xNew, yNew);
-    // Undo if cost not lowered
-    uint64_t c = cost();
-    if (c < currentCost) {
-      currentCost = c;
-      return true;
-    }
-    else {
+    int64_t delta = swapDelta(x, y, xNew, yNew);
+    if (delta < 0) {
       swap(x, y, xNew, yNew);
-      return false;
+      currentCost += delta;
+      return true;
     }
+    return false;
   }
 
   // Very simple local search algorithm for placement
   // Repeatedly swap a mesh node with it's neighbour if it lowers cost
+  void descend() {
+    bool change;
+    do {
+      change = false;
+      // Loop over mesh
+      for (uint32_t y = 0; y < height-1; y++) {
+        for (uint32_t x = 0; x < width-1; x++) {
+          change = trySwap(x, y, x+1, y) ||
+                     trySwap(x, y, x, y+1) ||
+                       trySwap(x, y, x+1, y+1) ||
+                         change;
+        }
+      }
+    } while (change);
+  }
+
+  // Simulated annealing, starting from the current placement, and
+  // stopping when cool (after a fixed number of moves) or when the
+  // given time budget, if non-zero, is exhausted
+  void anneal(double budget) {
+    uint32_t numPartitions = width*height;
+    if (numPartitions < 3) return;
+
+    // Start timer
+    struct timeval start, now, diff;
+    gettimeofday(&start, NULL);
+
+    // Initial temperature: mean cost increase over a sample of swaps
+    double total = 0;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < 4*numPartitions; i++) {
+      uint32_t p = getRand() % numPartitions;
+      uint32_t q = getRand() % numPartitions;
+      if (p == q) continue;
+      int64_t delta = swapDelta(xCoord[p], yCoord[p], xCoord[q], yCoord[q]);
+      if (delta > 0) { total += (double) delta; count++; }
+    }
+    if (count == 0) return;
+    double temp = total / count;
+    double minTemp = temp / 1000.0;
+
+    // Cooling schedule
+    const uint32_t movesPerTemp = 4 * numPartitions;
+    const double cooling = 0.9;
+
+    while (temp > minTemp) {
+      for (uint32_t i = 0; i < movesPerTemp; i++) {
+        uint32_t p = getRand() % numPartitions;
+        uint32_t q = getRand() % numPartitions;
+        if (p == q) continue;
+        uint32_t x = xCoord[p], y = yCoord[p];
+        uint32_t xNew = xCoord[q], yNew = yCoord[q];
+        int64_t delta = swapDelta(x, y, xNew, yNew);
+        if (delta <= 0 || getRandUnit() < exp(-(double) delta / temp)) {
+          swap(x, y, xNew, yNew);
+          currentCost += delta;
+        }
+      }
+      temp *= cooling;
+      // Check time budget
+      if (budget <= 0) continue;
+      gettimeofday(&now, NULL);
+      timersub(&now, &start, &diff);
+      double duration = (double) diff.tv_sec +
+                          (double) diff.tv_usec / 1000000.0;
+      if (duration > budget) break;
+    }
+  }
+
+  // Place partitions onto the mesh.  Each attempt starts from a random
+  // placement, refines it using simulated annealing, and finishes with
+  // a greedy local search.  The best placement found is kept.
   void place(uint32_t numAttempts) {
     // Initialise best cost
     savedCost = ~0;
@@ -402,20 +667,8 @@ struct Placer {
     for (uint32_t n = 0; n < numAttempts; n++) {
       randomPlacement();
       currentCost = cost();
-
-      bool change;
-      do {
-        change = false;
-        // Loop over mesh
-        for (uint32_t y = 0; y < height-1; y++) {
-          for (uint32_t x = 0; x < width-1; x++) {
-            change = trySwap(x, y, x+1, y) ||
-                       trySwap(x, y, x, y+1) ||
-                         trySwap(x, y, x+1, y+1) ||
-                           change;
-          }
-        }
-      } while (change);
+      anneal(timeBudget / numAttempts);
+      descend();
 
       if (currentCost <= savedCost)
         save();
@@ -425,14 +678,20 @@ struct Placer {
   }
 
   // Constructor
-  Placer(Graph* g, uint32_t w, uint32_t h) {
+  Placer(Graph* g, uint32_t w, uint32_t h, PlacerWeights* wts = NULL) {
     graph = g;
     width = w;
     height = h;
+    weights = wts;
+    // Ensure graph is in CSR form
+    graph->freeze();
     // Random seed
     setRand(1 + omp_get_thread_num());
+    // Time budget for placement
+    char* str = getenv("POLITE_PLACER_TIME");
+    timeBudget = str ? atof(str) : 0.0;
     // Allocate the partitions array
-    partitions = new PartitionId [g->incoming->numElems];
+    partitions = new PartitionId [g->numNodes];
     // Allocate subgraphs
     subgraphs = new Graph [width*height];
     // Allocate the connection count matrix
@@ -456,6 +715,8 @@ struct Placer {
     chooseMethod();
     // Partition the graph using Metis
     partition();
+    // Enforce partition capacities, if any
+    balance();
     // Compute subgraphs, one per partition
     computeSubgraphs();
     // Count connections between each pair of partitions
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Host-side decoder and functional simulator for the programmable
+// router tables produced by ProgRouterMesh (see ProgRouters.h and the
+// record formats in the README)
+
+#ifndef _PROGROUTERSIM_H_
+#define _PROGROUTERSIM_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <config.h>
+#include <POLite/Seq.h>
+#include <POLite/ProgRouters.h>
+
+// Routing record types
+enum ProgRouterTag {
+  PRTagURM1 = 0, PRTagURM2 = 1, PRTagRR = 2, PRTagMRM = 3, PRTagIND = 4
+};
+
+// A decoded routing record
+struct PRoutingRecord {
+  ProgRouterTag tag;
+  // Direction (RR only; N, S, E, W == 0, 1, 2, 3)
+  uint32_t dir;
+  // Board-local destination mailbox (URM1, URM2, and MRM)
+  uint32_t mboxX, mboxY;
+  // Mailbox-local destination thread (URM1 and URM2)
+  uint32_t thread;
+  // Destination threads (MRM)
+  uint32_t threadMaskLow, threadMaskHigh;
+  // Local key (URM1, URM2, and MRM) or new routing key (RR and IND)
+  uint64_t key;
+};
+
+// A message arriving at a thread, along with the local key written
+// into it by the router (or by the sender, for thread-to-thread sends)
+struct PRoutingDelivery {
+  uint32_t threadId;
+  uint64_t key;
+};
+
+class ProgRouterSim {
+  ProgRouterMesh* mesh;
+  uint32_t boardsX, boardsY;
+
+  // Keys waiting to be looked up during a simulation, and the
+  // records of the current lookup
+  struct Lookup { uint32_t x, y, key; };
+  Seq<Lookup> pending;
+  Seq<PRoutingRecord> records;
+
+  // For each board, the number of the last simulation to visit it
+  uint32_t* visited;
+  uint32_t numSims;
+
+  static inline uint32_t load32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+  }
+
+  inline bool fail(const char* msg) { error = msg; return false; }
+
+ public:
+  // Description of the last error detected
+  const char* error;
+
+  // Constructor
+  ProgRouterSim(ProgRouterMesh* m, uint32_t numBoardsX,
+                  uint32_t numBoardsY) : pending(64), records(64) {
+    mesh = m;
+    boardsX = numBoardsX;
+    boardsY = numBoardsY;
+    visited = (uint32_t*) calloc(boardsX * boardsY, sizeof(uint32_t));
+    numSims = 0;
+    error = NULL;
+  }
+
+  // Destructor
+  ~ProgRouterSim() { free(visited); }
+
+  // Decode the records associated with given key on given board,
+  // appending them to the records sequence and adding the number of
+  // beats fetched from DRAM to the beats counter.  IND records are
+  // followed (and not returned).  Returns false on a malformed table.
+  bool decode(uint32_t x, uint32_t y, uint32_t key,
+                Seq<PRoutingRecord>* out, uint32_t* beats) {
+    ProgRouter* router = &mesh->table[y][x];
+    uint32_t maxBeats = (router->table[0]->numElems +
+                           router->table[1]->numElems) / 32;
+    uint32_t fetched = 0;
+    while ((key & 0x1f) != 0) {
+      uint32_t numBeats = key & 0x1f;
+      uint32_t ptr = key & 0x7fffffe0;
+      Seq<uint8_t>* seq = router->table[key >> 31];
+      uint32_t tableSize = seq->numElems;
+      if (ptr < TinselPOLiteProgRouterBase ||
+            ptr - TinselPOLiteProgRouterBase + numBeats*32 > tableSize)
+        return fail("routing key points outside table");
+      fetched += numBeats;
+      if (fetched > maxBeats) return fail("cycle of IND records");
+      uint8_t* beat = &seq->elems[ptr - TinselPOLiteProgRouterBase];
+      uint32_t next = 0;
+      bool haveNext = false;
+      for (uint32_t b = 0; b < numBeats; b++, beat += 32) {
+        uint32_t numRecords = beat[30] | (beat[31] << 8);
+        if (numRecords < 1 || numRecords > 5)
+          return fail("bad number of records in beat");
+        uint32_t chunk = 0;
+        for (uint32_t i = 0; i < numRecords; i++) {
+          if (chunk >= 5) return fail("records overflow beat");
+          // Upper byte of record is upper byte of its first chunk
+          uint8_t* p = &beat[6*(4-chunk)];
+          PRoutingRecord r;
+          memset(&r, 0, sizeof(r));
+          r.tag = (ProgRouterTag) (p[5] >> 5);
+          if (r.tag == PRTagURM2 || r.tag == PRTagMRM) {
+            if (chunk >= 4) return fail("records overflow beat");
+            p -= 6;
+            r.mboxX = (p[11] >> 1) & ((1 << TinselMailboxMeshXBits) - 1);
+            r.mboxY = (p[11] >> 3) & ((1 << TinselMailboxMeshYBits) - 1);
+            if (r.tag == PRTagMRM) {
+              r.threadMaskLow = load32(&p[0]);
+              r.threadMaskHigh = load32(&p[4]);
+              r.key = p[8] | (p[9] << 8);
+            }
+            else {
+              r.thread = (p[10] >> 3) | ((p[11] & 1) << 5);
+              r.key = load32(&p[0]) | ((uint64_t) load32(&p[4]) << 32);
+            }
+            chunk += 2;
+          }
+          else {
+            r.key = load32(&p[0]);
+            if (r.tag == PRTagURM1) {
+              r.mboxX = (p[5] >> 1) & ((1 << TinselMailboxMeshXBits) - 1);
+              r.mboxY = (p[5] >> 3) & ((1 << TinselMailboxMeshYBits) - 1);
+              r.thread = (p[4] >> 3) | ((p[5] & 1) << 5);
+            }
+            else if (r.tag == PRTagRR)
+              r.dir = (p[5] >> 3) & 3;
+            else if (r.tag != PRTagIND)
+              return fail("unknown record type");
+            chunk++;
+          }
+          if (r.tag == PRTagIND) {
+            // At most one IND record per key lookup
+            if (haveNext) return fail("several IND records in lookup");
+            next = (uint32_t) r.key;
+            haveNext = true;
+          }
+          else
+            out->append(r);
+        }
+      }
+      // A max-sized key lookup must contain an IND record
+      if (numBeats == 31 && !haveNext)
+        return fail("max-sized key lookup without IND record");
+      key = haveNext ? next : 0;
+    }
+    *beats += fetched;
+    return true;
+  }
+
+  // Simulate a message sent to given routing key by a thread on given
+  // board, appending each thread it reaches to the deliveries
+  // sequence.  Also counts the DRAM beats fetched by all routers
+  // involved, and the number of inter-board hops.  Returns false if a
+  // table is malformed or a board would receive the message twice.
+  bool simulate(uint32_t x, uint32_t y, uint32_t key,
+                  Seq<PRoutingDelivery>* deliveries,
+                  uint32_t* beats, uint32_t* hops) {
+    numSims++;
+    *beats = *hops = 0;
+    pending.clear();
+    pending.append({x, y, key});
+    while (pending.numElems > 0) {
+      Lookup l = pending.pop();
+      uint32_t b = l.y * boardsX + l.x;
+      if (visited[b] == numSims) return fail("board visited twice");
+      visited[b] = numSims;
+      records.clear();
+      if (! decode(l.x, l.y, l.key, &records, beats)) return false;
+      for (uint32_t i = 0; i < (uint32_t) records.numElems; i++) {
+        PRoutingRecord* r = &records.elems[i];
+        // Global mailbox id
+        uint32_t mbox = l.y;
+        mbox = (mbox << TinselMeshXBits) | l.x;
+        mbox = (mbox << TinselMailboxMeshYBits) | r->mboxY;
+        mbox = (mbox << TinselMailboxMeshXBits) | r->mboxX;
+        uint32_t base = mbox << TinselLogThreadsPerMailbox;
+        if (r->tag == PRTagRR) {
+          int nx = l.x, ny = l.y;
+          if (r->dir == 0) ny++;
+          else if (r->dir == 1) ny--;
+          else if (r->dir == 2) nx++;
+          else nx--;
+          if (nx < 0 || ny < 0 || nx >= (int) boardsX || ny >= (int) boardsY)
+            return fail("RR record leaves board mesh");
+          pending.append({(uint32_t) nx, (uint32_t) ny, (uint32_t) r->key});
+          (*hops)++;
+        }
+        else if (r->tag == PRTagMRM) {
+          for (uint32_t t = 0; t < 64; t++) {
+            uint32_t mask = t < 32 ? r->threadMaskLow : r->threadMaskHigh;
+            if ((mask >> (t & 31)) & 1)
+              deliveries->append({base + t, r->key});
+          }
+        }
+        else
+          deliveries->append({base + r->thread, r->key});
+      }
+    }
+    return true;
+  }
+};
+
+#endif
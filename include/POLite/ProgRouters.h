@@ -31,6 +31,45 @@ class ProgRouter {
   // (We need indirections to handle record sequences of 31 beats or more)
   uint8_t* prevInd;
 
+  // Hash table of keys generated so far, so that identical record
+  // sequences can share a key.  Each entry holds a hash of the
+  // sequence's beats in the upper 32 bits and its key in the lower
+  // 32 bits (a zero entry is empty).
+  uint64_t* sharedKeys;
+  uint32_t sharedKeysSize;
+  uint32_t numSharedKeys;
+
+  // Hash of given bytes (never zero)
+  static uint32_t hashBytes(const uint8_t* bytes, uint32_t n) {
+    uint64_t h = 0xcbf29ce484222325ul;
+    for (uint32_t i = 0; i < n; i += 8) {
+      uint64_t word;
+      memcpy(&word, &bytes[i], 8);
+      h ^= word;
+      h *= 0x100000001b3ul;
+    }
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ul;
+    h ^= h >> 32;
+    return (uint32_t) h == 0 ? 1 : (uint32_t) h;
+  }
+
+  // Double the size of the sharedKeys table
+  void growSharedKeys() {
+    uint64_t* old = sharedKeys;
+    uint32_t oldSize = sharedKeysSize;
+    sharedKeysSize *= 2;
+    sharedKeys = (uint64_t*) calloc(sharedKeysSize, sizeof(uint64_t));
+    uint32_t mask = sharedKeysSize - 1;
+    for (uint32_t i = 0; i < oldSize; i++) {
+      if (old[i] == 0) continue;
+      uint32_t j = (old[i] >> 32) & mask;
+      while (sharedKeys[j] != 0) j = (j+1) & mask;
+      sharedKeys[j] = old[i];
+    }
+    free(old);
+  }
+
   // Move on to next the beat
   void nextBeat() {
     // Set number of records in current beat
@@ -85,6 +124,10 @@ class ProgRouter {
     prevInd = NULL;
     numBeats = 1;
     numChunks = numRecords = currentRAM = 0;
+    bytesShared = 0;
+    sharedKeysSize = 1 << 10;
+    sharedKeys = (uint64_t*) calloc(sharedKeysSize, sizeof(uint64_t));
+    numSharedKeys = 0;
     // Allocate one sequence per RAM
     table = new Seq<uint8_t>* [TinselDRAMsPerBoard];
     // Initially each sequence is 32MB
@@ -95,10 +138,14 @@ class ProgRouter {
     }
   }
 
+  // Number of table bytes saved by sharing keys (see genSharedKey)
+  uint64_t bytesShared;
+
   // Destructor
   ~ProgRouter() {
     for (int i = 0; i < TinselDRAMsPerBoard; i++) delete table[i];
     delete [] table;
+    stopSharing();
   }
 
   // Generate a new key for the records added
@@ -129,6 +176,53 @@ class ProgRouter {
     return key;
   }
 
+  // Like genKey(), but if an identical sequence of records was added
+  // earlier, remove the records just added and return the earlier key
+  uint32_t genSharedKey() {
+    // Sequences with indirections are not shared
+    if (sharedKeys == NULL || prevInd) return genKey();
+    // Fill in number of records in current beat, as nextBeat() would
+    Seq<uint8_t>* seq = table[currentRAM];
+    uint8_t* beat = &seq->elems[seq->numElems - 32];
+    beat[31] = 0;
+    beat[30] = numRecords;
+    // Look for an identical sequence of beats
+    uint32_t bytes = numBeats*32;
+    uint32_t index = seq->numElems - bytes;
+    uint8_t* beats = &seq->elems[index];
+    uint32_t hash = hashBytes(beats, bytes);
+    if (2*(numSharedKeys+1) > sharedKeysSize) growSharedKeys();
+    uint32_t mask = sharedKeysSize - 1;
+    uint32_t i = hash & mask;
+    for (; sharedKeys[i] != 0; i = (i+1) & mask) {
+      if ((sharedKeys[i] >> 32) != hash) continue;
+      uint32_t key = (uint32_t) sharedKeys[i];
+      if ((key & 0x1f) != numBeats) continue;
+      uint32_t ram = key >> 31;
+      uint32_t addr = (key & 0x7fffffe0) - TinselPOLiteProgRouterBase;
+      if (memcmp(&table[ram]->elems[addr], beats, bytes) != 0) continue;
+      // Found: discard the new records
+      seq->numElems = index + 32;
+      memset(beats, 0, 32);
+      numBeats = 1;
+      numChunks = numRecords = 0;
+      bytesShared += bytes;
+      return key;
+    }
+    // Not found: generate a new key and remember it
+    uint32_t key = genKey();
+    sharedKeys[i] = ((uint64_t) hash << 32) | key;
+    numSharedKeys++;
+    return key;
+  }
+
+  // Release the structures used for sharing keys
+  // (No further sharing takes place)
+  void stopSharing() {
+    if (sharedKeys) free(sharedKeys);
+    sharedKeys = NULL;
+  }
+
   // Add an IND record to the table
   // Return a pointer to the indirection key,
   // so it can be set later by the caller
@@ -262,29 +356,239 @@ inline uint32_t destMboxY(uint32_t mbox) {
 // Mesh of programmable routers
 // ============================
 
+// Comparison function for PRoutingDest
+// (Gives a canonical order for the local records on a board)
+inline int cmpRoutingDest(const void* d0, const void* d1) {
+  const PRoutingDest* a = (const PRoutingDest*) d0;
+  const PRoutingDest* b = (const PRoutingDest*) d1;
+  uint32_t ka[4], kb[4];
+  const PRoutingDest* d[] = { a, b };
+  uint32_t* k[] = { ka, kb };
+  for (int i = 0; i < 2; i++) {
+    k[i][0] = (d[i]->kind << 28) | d[i]->mbox;
+    if (d[i]->kind == PRDestKindMRM) {
+      k[i][1] = d[i]->mrm.key;
+      k[i][2] = d[i]->mrm.threadMaskLow;
+      k[i][3] = d[i]->mrm.threadMaskHigh;
+    }
+    else {
+      k[i][1] = d[i]->urm1.key;
+      k[i][2] = d[i]->urm1.threadId;
+      k[i][3] = 0;
+    }
+  }
+  for (int i = 0; i < 4; i++)
+    if (ka[i] != kb[i]) return ka[i] < kb[i] ? -1 : 1;
+  return 0;
+}
+
+// A multicast tree over the board mesh, for a given sender board and
+// set of destination boards.  For each board, it holds the direction
+// (N, S, E, W == 0, 1, 2, 3) of the link from its parent, or one of
+// the values below.
+#define ProgRouterMaxBoards 64
+#define ProgRouterTreeRoot 4
+#define ProgRouterNotInTree 5
+struct ProgRouterTree {
+  uint64_t destBoards;
+  uint32_t sender;
+  uint8_t dir[ProgRouterMaxBoards];
+};
+
 class ProgRouterMesh {
   // Board mesh dimensions
   uint32_t boardsX;
   uint32_t boardsY;
 
- public:
-  // 2D array of tables;
-  ProgRouter** table;
+  // Multicast trees computed so far (open-addressing hash table,
+  // where a zero destBoards field denotes an empty entry)
+  ProgRouterTree* trees;
+  uint32_t treesSize;
+  uint32_t numTrees;
 
-  // Constructor
-  ProgRouterMesh(uint32_t numBoardsX, uint32_t numBoardsY) {
-    boardsX = numBoardsX;
-    boardsY = numBoardsY;
-    table = new ProgRouter* [numBoardsY];
-    for (int y = 0; y < numBoardsY; y++)
-      table[y] = new ProgRouter [numBoardsX];
+  static inline int minInt(int x, int y) { return x < y ? x : y; }
+
+  // Board index and bit for given coordinates
+  inline uint32_t boardIndex(int x, int y) { return y*boardsX + x; }
+  inline uint64_t boardBit(int x, int y) { return 1ul << boardIndex(x, y); }
+
+  // Boards on the path from (x0, y0) to (x1, y1), moving in X first
+  uint64_t path(int x0, int y0, int x1, int y1) {
+    uint64_t boards = boardBit(x0, y0);
+    while (x0 != x1) { x0 += x0 < x1 ? 1 : -1; boards |= boardBit(x0, y0); }
+    while (y0 != y1) { y0 += y0 < y1 ? 1 : -1; boards |= boardBit(x0, y0); }
+    return boards;
   }
 
-  // Add routing destinations from given sender board
+  // Boards of a rectilinear Steiner arborescence, rooted at the sender
+  // and reaching the given destinations in one quadrant to the east,
+  // with all paths moving east and towards the destination row
+  // (ydir = 1 for north, -1 for south).  This is the greedy heuristic
+  // of Rao et al.: repeatedly replace the two points whose meeting
+  // point is furthest from the root by that meeting point.
+  uint64_t arborescence(int sx, int sy, int ydir,
+                          int* us, int* vs, uint32_t n) {
+    uint64_t boards = boardBit(sx, sy);
+    while (n > 1) {
+      uint32_t bi = 0, bj = 1;
+      int best = -1;
+      for (uint32_t i = 0; i < n; i++)
+        for (uint32_t j = i+1; j < n; j++) {
+          int d = minInt(us[i], us[j]) + minInt(vs[i], vs[j]);
+          if (d > best) { best = d; bi = i; bj = j; }
+        }
+      int mu = minInt(us[bi], us[bj]);
+      int mv = minInt(vs[bi], vs[bj]);
+      boards |= path(sx+mu, sy+ydir*mv, sx+us[bi], sy+ydir*vs[bi]);
+      boards |= path(sx+mu, sy+ydir*mv, sx+us[bj], sy+ydir*vs[bj]);
+      // Replace the pair by the meeting point
+      us[bj] = us[n-1]; vs[bj] = vs[n-1]; n--;
+      us[bi] = mu; vs[bi] = mv;
+      for (uint32_t i = 0; i < n; i++)
+        if (i != bi && us[i] == mu && vs[i] == mv) {
+          us[bi] = us[n-1]; vs[bi] = vs[n-1]; n--;
+          break;
+        }
+    }
+    if (n == 1) boards |= path(sx, sy, sx+us[0], sy+ydir*vs[0]);
+    return boards;
+  }
+
+  // Compute the multicast tree for given sender and destination boards
+  void computeTree(ProgRouterTree* tree) {
+    int sx = tree->sender % boardsX;
+    int sy = tree->sender / boardsX;
+    uint64_t dests = tree->destBoards;
+    uint32_t numBoards = boardsX * boardsY;
+
+    // Dimension-ordered tree: the union of the X-then-Y paths
+    uint64_t xy = boardBit(sx, sy);
+    for (uint32_t b = 0; b < numBoards; b++)
+      if (dests >> b & 1) xy |= path(sx, sy, b % boardsX, b / boardsX);
+
+    // Steiner-like tree: destinations to the west are reached as above,
+    // and those in each quadrant to the east by an arborescence
+    uint64_t st = boardBit(sx, sy);
+    int us[2][ProgRouterMaxBoards], vs[2][ProgRouterMaxBoards];
+    uint32_t n[2] = { 0, 0 };
+    for (uint32_t b = 0; b < numBoards; b++) {
+      if (!(dests >> b & 1)) continue;
+      int x = b % boardsX, y = b / boardsX;
+      if (x < sx) st |= path(sx, sy, x, y);
+      else if (x != sx || y != sy) {
+        int q = y >= sy ? 0 : 1;
+        us[q][n[q]] = x - sx;
+        vs[q][n[q]] = y >= sy ? y - sy : sy - y;
+        n[q]++;
+      }
+    }
+    st |= arborescence(sx, sy, 1, us[0], vs[0], n[0]);
+    st |= arborescence(sx, sy, -1, us[1], vs[1], n[1]);
+
+    // Use the Steiner-like tree if it visits fewer boards.  Every board
+    // visited costs one inter-board link traversal and one key lookup
+    // (with an RR record in its parent), so this is the cost model.
+    uint32_t stSize = assignParents(tree, st, true);
+    if (stSize >= (uint32_t) __builtin_popcountll(xy))
+      assignParents(tree, xy, false);
+  }
+
+  // Fill in the tree for given set of boards, returning the number of
+  // boards in the tree.  In a Steiner-like tree, a board to the east
+  // of the sender and off its row prefers its western neighbour as
+  // parent, so that trunks are shared.  Boards that are then left
+  // without children or destinations are pruned.
+  uint32_t assignParents(ProgRouterTree* tree, uint64_t boards,
+                           bool steiner) {
+    int sx = tree->sender % boardsX;
+    int sy = tree->sender / boardsX;
+    uint32_t numBoards = boardsX * boardsY;
+    uint32_t children[ProgRouterMaxBoards];
+    for (uint32_t b = 0; b < numBoards; b++) {
+      tree->dir[b] = ProgRouterNotInTree;
+      children[b] = 0;
+    }
+    uint32_t size = 0;
+    for (uint32_t b = 0; b < numBoards; b++) {
+      if (!(boards >> b & 1)) continue;
+      size++;
+      int x = b % boardsX, y = b / boardsX;
+      uint32_t dir;
+      if (x == sx && y == sy) { tree->dir[b] = ProgRouterTreeRoot; continue; }
+      else if (y == sy) dir = x > sx ? 2 : 3;
+      else if (steiner && x > sx && (boards & boardBit(x-1, y))) dir = 2;
+      else dir = y > sy ? 0 : 1;
+      tree->dir[b] = dir;
+      children[parent(b, dir)]++;
+    }
+    bool pruned = steiner;
+    while (pruned) {
+      pruned = false;
+      for (uint32_t b = 0; b < numBoards; b++) {
+        uint32_t dir = tree->dir[b];
+        if (dir < 4 && children[b] == 0 && !(tree->destBoards >> b & 1)) {
+          tree->dir[b] = ProgRouterNotInTree;
+          children[parent(b, dir)]--;
+          size--;
+          pruned = true;
+        }
+      }
+    }
+    return size;
+  }
+
+  // Parent of given board, given the direction of the link from it
+  inline uint32_t parent(uint32_t b, uint32_t dir) {
+    int x = b % boardsX, y = b / boardsX;
+    if (dir == 0) y--;
+    else if (dir == 1) y++;
+    else if (dir == 2) x--;
+    else x++;
+    return boardIndex(x, y);
+  }
+
+  // Lookup (or compute) multicast tree for given sender and
+  // destination boards
+  ProgRouterTree* getTree(uint32_t sender, uint64_t destBoards) {
+    // Keep load factor below one half
+    if (2*(numTrees+1) > treesSize) {
+      ProgRouterTree* old = trees;
+      uint32_t oldSize = treesSize;
+      treesSize = oldSize == 0 ? 64 : 2*oldSize;
+      trees = (ProgRouterTree*) calloc(treesSize, sizeof(ProgRouterTree));
+      for (uint32_t i = 0; i < oldSize; i++) {
+        if (old[i].destBoards == 0) continue;
+        uint32_t j = treeHash(old[i].sender, old[i].destBoards);
+        while (trees[j].destBoards != 0) j = (j+1) & (treesSize-1);
+        trees[j] = old[i];
+      }
+      free(old);
+    }
+    uint32_t i = treeHash(sender, destBoards);
+    for (; trees[i].destBoards != 0; i = (i+1) & (treesSize-1))
+      if (trees[i].destBoards == destBoards && trees[i].sender == sender)
+        return &trees[i];
+    trees[i].destBoards = destBoards;
+    trees[i].sender = sender;
+    computeTree(&trees[i]);
+    numTrees++;
+    return &trees[i];
+  }
+
+  // Hash table index for given sender and destination boards
+  inline uint32_t treeHash(uint32_t sender, uint64_t destBoards) {
+    uint64_t h = (destBoards ^ sender) * 0x9e3779b97f4a7c15ul;
+    return (h >> 32) & (treesSize-1);
+  }
+
+  // Add routing destinations from given board, following the given
+  // multicast tree (or dimension-ordered routing if NULL)
   // Returns routing key
-  uint32_t addDestsFromBoardXY(uint32_t senderX, uint32_t senderY,
-                                 Seq<PRoutingDest>* dests) {
+  uint32_t addDestsFromBoardTree(uint32_t senderX, uint32_t senderY,
+                                   Seq<PRoutingDest>* dests,
+                                   ProgRouterTree* tree) {
     if (dests->numElems == 0) return 0;
+    numHops++;
 
     // Categorise dests into local, N, S, E, and W groups
     Seq<PRoutingDest> local(dests->numElems);
@@ -292,11 +596,21 @@ class ProgRouterMesh {
     Seq<PRoutingDest> south(dests->numElems);
     Seq<PRoutingDest> east(dests->numElems);
     Seq<PRoutingDest> west(dests->numElems);
+    Seq<PRoutingDest>* groups[] = { &north, &south, &east, &west };
+    uint32_t current = boardIndex(senderX, senderY);
     for (int i = 0; i < dests->numElems; i++) {
       PRoutingDest dest = dests->elems[i];
       uint32_t receiverX = destX(dest.mbox);
       uint32_t receiverY = destY(dest.mbox);
-      if (receiverX < senderX) west.append(dest);
+      if (tree) {
+        // Find the child on the path to the receiver
+        uint32_t b = boardIndex(receiverX, receiverY);
+        if (b == current) { local.append(dest); continue; }
+        while (parent(b, tree->dir[b]) != current)
+          b = parent(b, tree->dir[b]);
+        groups[tree->dir[b]]->append(dest);
+      }
+      else if (receiverX < senderX) west.append(dest);
       else if (receiverX > senderX) east.append(dest);
       else if (receiverY < senderY) south.append(dest);
       else if (receiverY > senderY) north.append(dest);
@@ -305,23 +619,25 @@ class ProgRouterMesh {
 
     // Recurse on non-local groups and add RR records on return
     if (north.numElems > 0) {
-      uint32_t key = addDestsFromBoardXY(senderX, senderY+1, &north);
+      uint32_t key = addDestsFromBoardTree(senderX, senderY+1, &north, tree);
       table[senderY][senderX].addRR(0, key);
     }
     if (south.numElems > 0) {
-      uint32_t key = addDestsFromBoardXY(senderX, senderY-1, &south);
+      uint32_t key = addDestsFromBoardTree(senderX, senderY-1, &south, tree);
       table[senderY][senderX].addRR(1, key);
     }
     if (east.numElems > 0) {
-      uint32_t key = addDestsFromBoardXY(senderX+1, senderY, &east);
+      uint32_t key = addDestsFromBoardTree(senderX+1, senderY, &east, tree);
       table[senderY][senderX].addRR(2, key);
     }
     if (west.numElems > 0) {
-      uint32_t key = addDestsFromBoardXY(senderX-1, senderY, &west);
+      uint32_t key = addDestsFromBoardTree(senderX-1, senderY, &west, tree);
       table[senderY][senderX].addRR(3, key);
     }
 
-    // Add local records
+    // Add local records, in a canonical order so that identical
+    // destination sets give identical record sequences
+    qsort(local.elems, local.numElems, sizeof(PRoutingDest), cmpRoutingDest);
     for (int i = 0; i < local.numElems; i++) {
       PRoutingDest dest = local.elems[i];
       if (dest.kind == PRDestKindMRM) {
@@ -339,7 +655,76 @@ class ProgRouterMesh {
       }
     }
 
-    return table[senderY][senderX].genKey();
+    return table[senderY][senderX].genSharedKey();
+  }
+
+ public:
+  // 2D array of tables;
+  ProgRouter** table;
+
+  // Use Steiner-like multicast trees between boards, rather than
+  // dimension-ordered routing (see README)
+  bool steinerTrees;
+
+  // Number of routers visited by one message sent to each key
+  // generated by addDestsFromBoard (i.e. board-level hops plus one)
+  uint64_t numHops;
+
+  // Constructor
+  ProgRouterMesh(uint32_t numBoardsX, uint32_t numBoardsY) {
+    boardsX = numBoardsX;
+    boardsY = numBoardsY;
+    table = new ProgRouter* [numBoardsY];
+    for (int y = 0; y < numBoardsY; y++)
+      table[y] = new ProgRouter [numBoardsX];
+    trees = NULL;
+    treesSize = numTrees = 0;
+    numHops = 0;
+    steinerTrees = false;
+    char* str = getenv("POLITE_ROUTING");
+    if (str != NULL) {
+      if (!strcmp(str, "steiner"))
+        steinerTrees = true;
+      else if (strcmp(str, "xy") && *str != '\0') {
+        fprintf(stderr, "Don't understand routing method : %s\n", str);
+        exit(EXIT_FAILURE);
+      }
+    }
+    if (boardsX * boardsY > ProgRouterMaxBoards) steinerTrees = false;
+  }
+
+  // Add routing destinations from given sender board
+  // Returns routing key
+  uint32_t addDestsFromBoardXY(uint32_t senderX, uint32_t senderY,
+                                 Seq<PRoutingDest>* dests) {
+    ProgRouterTree* tree = NULL;
+    if (steinerTrees && dests->numElems > 0) {
+      uint64_t destBoards = 0;
+      for (int i = 0; i < dests->numElems; i++) {
+        uint32_t mbox = dests->elems[i].mbox;
+        destBoards |= boardBit(destX(mbox), destY(mbox));
+      }
+      tree = getTree(boardIndex(senderX, senderY), destBoards);
+    }
+    return addDestsFromBoardTree(senderX, senderY, dests, tree);
+  }
+
+  // Number of table bytes saved by sharing keys between identical
+  // record sequences
+  uint64_t bytesShared() {
+    uint64_t n = 0;
+    for (int y = 0; y < boardsY; y++)
+      for (int x = 0; x < boardsX; x++)
+        n += table[y][x].bytesShared;
+    return n;
+  }
+
+  // Release the structures used for sharing keys
+  // (No further sharing takes place)
+  void stopSharing() {
+    for (int y = 0; y < boardsY; y++)
+      for (int x = 0; x < boardsX; x++)
+        table[y][x].stopSharing();
   }
 
   // Add routing destinations from given global mailbox id
@@ -348,64 +733,67 @@ class ProgRouterMesh {
   }
 
   // Write routing tables to memory via HostLink
+  // (Each table is split into line-aligned slices, one for each core
+  // attached to the table's DRAM, so that the cores store in parallel
+  // and no line is written by more than one cache.  Stores are
+  // interleaved across all boards, DRAMs, and cores, and carry as many
+  // words as the boot loader allows.)
   void write(HostLink* hostLink) {
-    // Request to boot loader
-    BootReq req;
-
     // Compute number of cores per DRAM
     const uint32_t coresPerDRAM = 1 <<
       (TinselLogCoresPerDCache + TinselLogDCachesPerDRAM);
+    const uint32_t lineMask = (1 << TinselLogBytesPerLine) - 1;
 
-    // Initialise write address for each routing table
+    // Initialise write address for each slice
+    uint32_t maxSlice = 0;
     for (int y = 0; y < boardsY; y++) {
       for (int x = 0; x < boardsX; x++) {
         for (int i = 0; i < TinselDRAMsPerBoard; i++) {
-          // Use one core to initialise each DRAM
-          uint32_t dest = hostLink->toAddr(x, y, coresPerDRAM * i, 0);
-          req.cmd = SetAddrCmd;
-          req.numArgs = 1;
-          req.args[0] = TinselPOLiteProgRouterBase;
-          hostLink->send(dest, 1, &req);
-          // Ensure space for an extra 32 bytes in each 
-          // table so we don't have to check for overflow below
-          // when consuming the tables in chunks of 12 bytes
-          table[y][x].table[i]->ensureSpaceFor(32);
+          uint32_t len = table[y][x].table[i]->numElems;
+          uint32_t slice = sliceBytes(len, coresPerDRAM, lineMask);
+          if (slice > maxSlice) maxSlice = slice;
+          for (uint32_t c = 0; c < coresPerDRAM && c*slice < len; c++)
+            hostLink->setAddr(x, y, coresPerDRAM * i + c,
+              TinselPOLiteProgRouterBase + c*slice);
         }
       }
     }
 
     // Write each routing table
-    bool allDone = false;
-    uint32_t offset = 0;
-    while (! allDone) {
-      allDone = true;
+    for (uint32_t offset = 0; offset < maxSlice; offset += 60) {
       for (int y = 0; y < boardsY; y++) {
         for (int x = 0; x < boardsX; x++) {
           for (int i = 0; i < TinselDRAMsPerBoard; i++) {
             Seq<uint8_t>* seq = table[y][x].table[i];
-            if (offset < seq->numElems) {
-              uint32_t dest = hostLink->toAddr(x, y, coresPerDRAM * i, 0);
-              uint8_t* base = &seq->elems[offset];
-              allDone = false;
-              req.cmd = StoreCmd;
-              req.numArgs = 3;
-              req.args[0] = ((uint32_t*) base)[0];
-              req.args[1] = ((uint32_t*) base)[1];
-              req.args[2] = ((uint32_t*) base)[2];
-              hostLink->send(dest, 1, &req);
+            uint32_t slice = sliceBytes(seq->numElems, coresPerDRAM, lineMask);
+            if (offset >= slice) continue;
+            for (uint32_t c = 0; c < coresPerDRAM; c++) {
+              uint32_t start = c*slice + offset;
+              uint32_t end = (c+1)*slice;
+              if (end > seq->numElems) end = seq->numElems;
+              if (start >= end) break;
+              uint32_t send = end - start > 60 ? 15 : (end - start) >> 2;
+              hostLink->store(x, y, coresPerDRAM * i + c, send,
+                (uint32_t*) &seq->elems[start]);
             }
           }
         }
       }
-      offset += 12;
     }
   }
 
+  // Size of each core's slice of a table of given length (see write)
+  static inline uint32_t sliceBytes(uint32_t len, uint32_t numCores,
+                                      uint32_t lineMask) {
+    return ((len + numCores - 1) / numCores + lineMask) & ~lineMask;
+  }
+
   // Destructor
   ~ProgRouterMesh() {
      for (int y = 0; y < boardsY; y++)
        delete [] table[y];
      delete [] table;
+     if (trees) free(trees);
   }
 };
 
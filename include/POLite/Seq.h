@@ -4,18 +4,127 @@
 #ifndef _SEQ_H_
 #define _SEQ_H_
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
+#include <mutex>
+#include <type_traits>
+
+// Report allocation failure
+inline void seqOutOfMemory() {
+  fprintf(stderr, "Seq: out of memory\n");
+  exit(EXIT_FAILURE);
+}
+
+// An arena is a region of memory from which sequences can be allocated
+// and which is released in bulk.  Allocation bumps a pointer within
+// large blocks, and the most recent allocation can be grown in place.
+// It is safe to allocate from several threads at once.
+class SeqArena {
+  // Blocks are held in a list, most recent first
+  struct Block {
+    Block* next;
+    size_t size;
+    size_t used;
+    size_t padding;  // Keeps data 16-byte aligned
+  };
+
+  // Default block size in bytes
+  static const size_t blockSize = 1 << 20;
+
+  Block* head;
+  std::mutex lock;
+
+  // Round up to a multiple of 16 bytes
+  static inline size_t align(size_t bytes) { return (bytes + 15) & ~15ul; }
+
+  // Start of data in given block
+  static inline uint8_t* data(Block* b) { return (uint8_t*) (b + 1); }
+
+ public:
+  // Constructor
+  SeqArena() { head = NULL; }
+
+  // Allocate given number of bytes (uninitialised, 16-byte aligned)
+  void* alloc(size_t bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    bytes = align(bytes);
+    if (head != NULL && head->used + bytes <= head->size) {
+      void* ptr = data(head) + head->used;
+      head->used += bytes;
+      return ptr;
+    }
+    // Large requests get a block of their own, behind the current one
+    bool large = bytes > blockSize/4;
+    size_t size = large ? bytes : blockSize;
+    Block* b = (Block*) malloc(sizeof(Block) + size);
+    if (b == NULL) seqOutOfMemory();
+    b->size = size;
+    b->used = bytes;
+    if (large && head != NULL) {
+      b->next = head->next;
+      head->next = b;
+    }
+    else {
+      b->next = head;
+      head = b;
+    }
+    return data(b);
+  }
+
+  // Try to grow an allocation in place, returning false if it is not
+  // the most recent allocation or there is no room
+  bool grow(void* ptr, size_t oldBytes, size_t newBytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    oldBytes = align(oldBytes);
+    newBytes = align(newBytes);
+    if (head == NULL || head->used < oldBytes) return false;
+    size_t start = head->used - oldBytes;
+    if ((uint8_t*) ptr != data(head) + start) return false;
+    if (start + newBytes > head->size) return false;
+    head->used = start + newBytes;
+    return true;
+  }
+
+  // Release all memory allocated from the arena
+  void release() {
+    std::lock_guard<std::mutex> guard(lock);
+    while (head != NULL) {
+      Block* next = head->next;
+      free(head);
+      head = next;
+    }
+  }
+
+  // Destructor
+  ~SeqArena() { release(); }
+};
 
 template <class T> class Seq
 {
   private:
+    // Elements that can be moved with memcpy are held in memory from
+    // malloc (or an arena) and grown using realloc; others use new[]
+    static const bool flat = std::is_trivially_copyable<T>::value;
+
+    // Arena holding the elements (NULL if on the heap)
+    SeqArena* arena;
+
     // Initialisation
-    void init(int initialSize)
+    void init(int initialSize, SeqArena* a)
     {
-      maxElems = initialSize;
+      assert(a == NULL || flat);
+      arena    = a;
+      maxElems = initialSize > 0 ? initialSize : 1;
       numElems = 0;
-      elems    = new T[initialSize];
+      if (arena) elems = (T*) arena->alloc(maxElems * sizeof(T));
+      else if (flat) {
+        elems = (T*) malloc(maxElems * sizeof(T));
+        if (elems == NULL) seqOutOfMemory();
+      }
+      else elems = new T[maxElems];
     }
 
   public:
@@ -24,12 +133,17 @@ template <class T> class Seq
     T* elems;
 
     // Constructors
-    Seq() { init(4096); }
-    Seq(int initialSize) { init(initialSize); }
+    Seq() { init(4096, NULL); }
+    Seq(int initialSize) { init(initialSize, NULL); }
 
-    // Copy constructor
+    // Constructor for a sequence held in the given arena.  Its memory
+    // is reclaimed when the arena is released, which makes running the
+    // destructor optional.
+    Seq(int initialSize, SeqArena* a) { init(initialSize, a); }
+
+    // Copy constructor (the copy is always held on the heap)
     Seq(const Seq<T>& seq) {
-      init(seq.maxElems);
+      init(seq.maxElems, NULL);
       numElems = seq.numElems;
       for (int i = 0; i < seq.numElems; i++)
         elems[i] = seq.elems[i];
@@ -37,20 +151,38 @@ template <class T> class Seq
 
     // Set capacity of sequence
     void setCapacity(int n) {
+      if (n < 1) n = 1;
+      if (numElems > n) numElems = n;
+      if (arena) {
+        if (! arena->grow(elems, maxElems * sizeof(T), n * sizeof(T))) {
+          T* newElems = (T*) arena->alloc(n * sizeof(T));
+          memcpy((void*) newElems, (void*) elems, numElems * sizeof(T));
+          elems = newElems;
+        }
+      }
+      else if (flat) {
+        T* newElems = (T*) realloc((void*) elems, n * sizeof(T));
+        if (newElems == NULL) seqOutOfMemory();
+        elems = newElems;
+      }
+      else {
+        T* newElems = new T[n];
+        for (int i = 0; i < numElems; i++)
+          newElems[i] = elems[i];
+        delete [] elems;
+        elems = newElems;
+      }
       maxElems = n;
-      T* newElems = new T[maxElems];
-      for (int i = 0; i < numElems-1; i++)
-        newElems[i] = elems[i];
-      delete [] elems;
-      elems = newElems;
     }
 
     // Extend size of sequence by N
+    // (New elements are zeroed if T can be moved with memcpy)
     void extendBy(int n)
     {
+      if (numElems + n > maxElems)
+        setCapacity((numElems + n) * 2);
+      if (flat) memset((void*) &elems[numElems], 0, n * sizeof(T));
       numElems += n;
-      if (numElems > maxElems)
-        setCapacity(numElems*2);
     }
 
     // Extend size of sequence by one
@@ -70,8 +202,9 @@ template <class T> class Seq
     // Append
     void append(T x)
     {
-      extend();
-      elems[numElems-1] = x;
+      if (numElems == maxElems)
+        setCapacity((numElems + 1) * 2);
+      elems[numElems++] = x;
     }
 
     // Delete last element
@@ -95,6 +228,15 @@ template <class T> class Seq
       numElems = 0;
     }
 
+    // Exchange contents with another sequence
+    void swap(Seq<T>& other)
+    {
+      SeqArena* a = arena; arena = other.arena; other.arena = a;
+      int m = maxElems; maxElems = other.maxElems; other.maxElems = m;
+      int n = numElems; numElems = other.numElems; other.numElems = n;
+      T* e = elems; elems = other.elems; other.elems = e;
+    }
+
     // Is given value already in sequence?
     bool member(T x) {
       for (int i = 0; i < numElems; i++)
@@ -123,7 +265,9 @@ template <class T> class Seq
     // Destructor
     ~Seq()
     {
-      delete [] elems;
+      if (arena) return;
+      if (flat) free((void*) elems);
+      else delete [] elems;
     }
 };
 
@@ -131,6 +275,7 @@ template <class T> class Seq
 template <class T> class SmallSeq : public Seq<T> {
   public:
     SmallSeq() : Seq<T>(8) {};
+    SmallSeq(SeqArena* a) : Seq<T>(8, a) {};
 };
 
 #endif
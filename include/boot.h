@@ -21,12 +21,12 @@ typedef enum {
   SetAddrCmd,
 
   // Write to instruction memory and increment address register.
-  // Argument: up to 3 x 32-bit instructions to write.
+  // Argument: up to 15 x 32-bit instructions to write.
   // The address is taken from the address register.
   WriteInstrCmd,
  
   // Perform a store instruction and increment address register.
-  // Argument: up to 3 x 32-bit words to store.
+  // Argument: up to 15 x 32-bit words to store.
   // The address is taken from the address register.
   StoreCmd,
 
@@ -41,6 +41,11 @@ typedef enum {
   // to start.
   StartCmd,
 
+  // Store zeros and increment address register.
+  // Argument: the number of 32-bit words to zero.
+  // The address is taken from the address register.
+  ZeroCmd,
+
 } BootCmd;
 
 
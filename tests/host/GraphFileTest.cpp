@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Check that GraphFile accepts a valid graph file and rejects corrupt
+// ones without reading outside the mapping
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <GraphFile.h>
+
+// Small graph: a ring of 5 nodes plus one extra edge
+static const uint32_t numNodes = 5;
+static const uint32_t numEdges = 6;
+static const uint32_t offsets[] = { 0, 2, 3, 4, 5, 6 };
+static const uint32_t neighbours[] = { 1, 3, 2, 3, 4, 0 };
+
+// Byte offsets of the sections in the file
+static const long offsetsPos = graphFilePad(sizeof(GraphFileHeader));
+static const long neighboursPos = offsetsPos + graphFilePad(4*(numNodes+1));
+
+// Overwrite a word of the file
+static void poke(const char* filename, long pos, uint32_t val)
+{
+  FILE* fp = fopen(filename, "r+b");
+  if (fp == NULL || fseek(fp, pos, SEEK_SET) != 0 ||
+        fwrite(&val, sizeof(val), 1, fp) != 1) {
+    fprintf(stderr, "Can't modify '%s'\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+}
+
+// Write the graph, apply a corruption, and check the result of opening
+static bool check(const char* what, long pos, uint32_t val, bool valid)
+{
+  char filename[] = "/tmp/GraphFileTestXXXXXX";
+  int fd = mkstemp(filename);
+  if (fd == -1) {
+    perror("mkstemp");
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  if (! writeGraphFile(filename, numNodes, numEdges, offsets, neighbours)) {
+    fprintf(stderr, "Can't write '%s'\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  if (pos >= 0) poke(filename, pos, val);
+  GraphFile g;
+  bool ok = g.open(filename) == valid;
+  if (ok && valid)
+    ok = g.numNodes == numNodes && g.numEdges == numEdges &&
+         memcmp(g.offsets, offsets, sizeof(offsets)) == 0 &&
+         memcmp(g.neighbours, neighbours, sizeof(neighbours)) == 0;
+  g.close();
+  unlink(filename);
+  printf("%s: %s\n", what, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main()
+{
+  const long numNodesPos = offsetof(GraphFileHeader, numNodes);
+  bool ok = true;
+  ok &= check("valid file", -1, 0, true);
+  ok &= check("numNodes wraps", numNodesPos, 0xffffffff, false);
+  ok &= check("numNodes too large", numNodesPos, 1000, false);
+  ok &= check("first offset non-zero", offsetsPos, 1, false);
+  ok &= check("offsets decrease", offsetsPos + 4*2, 5, false);
+  ok &= check("neighbour out of range", neighboursPos + 4*3, numNodes, false);
+  if (! ok) return EXIT_FAILURE;
+  printf("All tests passed\n");
+  return 0;
+}
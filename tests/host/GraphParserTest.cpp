@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Check GraphParser against a simple reference reader, on graphs whose
+// node counts lie either side of the parser's bucket boundaries
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <GraphParser.h>
+
+typedef std::vector<std::pair<uint32_t, uint32_t> > Edges;
+
+// Write edges to a temporary SNAP file, returning its name
+static char* writeSNAP(const Edges& edges)
+{
+  static char name[] = "/tmp/GraphParserTestXXXXXX";
+  char* filename = strdup(name);
+  int fd = mkstemp(filename);
+  if (fd == -1) {
+    perror("mkstemp");
+    exit(EXIT_FAILURE);
+  }
+  FILE* fp = fdopen(fd, "w");
+  fprintf(fp, "# Test graph\n");
+  for (size_t i = 0; i < edges.size(); i++)
+    fprintf(fp, "%u %u\n", edges[i].first, edges[i].second);
+  fclose(fp);
+  return filename;
+}
+
+// Parse edges and compare the result with the expected neighbour lists
+static bool check(const char* what, const Edges& edges, uint32_t flags)
+{
+  // Expected result
+  uint32_t numNodes = 0;
+  for (size_t i = 0; i < edges.size(); i++) {
+    uint32_t m = std::max(edges[i].first, edges[i].second);
+    if (m >= numNodes) numNodes = m+1;
+  }
+  std::vector<std::vector<uint32_t> > expected(numNodes);
+  for (size_t i = 0; i < edges.size(); i++) {
+    expected[edges[i].first].push_back(edges[i].second);
+    if (flags & GraphParseUndirected)
+      expected[edges[i].second].push_back(edges[i].first);
+  }
+  uint32_t numEdges = 0;
+  for (uint32_t i = 0; i < numNodes; i++) {
+    if (flags & GraphParseReverseOrder)
+      std::reverse(expected[i].begin(), expected[i].end());
+    numEdges += expected[i].size();
+  }
+
+  // Actual result
+  char* filename = writeSNAP(edges);
+  GraphParser parser;
+  bool ok = parser.parse(filename, GraphSNAP, flags);
+  unlink(filename);
+  free(filename);
+  if (ok && (parser.numNodes != numNodes || parser.numEdges != numEdges))
+    ok = false;
+  for (uint32_t i = 0; ok && i < numNodes; i++) {
+    uint32_t n = parser.offsets[i+1] - parser.offsets[i];
+    if (n != expected[i].size()) { ok = false; break; }
+    for (uint32_t j = 0; j < n; j++)
+      if (parser.dests[parser.offsets[i] + j] != expected[i][j]) ok = false;
+  }
+  printf("%-4s %s (flags %u)\n", ok ? "ok" : "FAIL", what, flags);
+  return ok;
+}
+
+int main()
+{
+  bool ok = true;
+  const uint32_t sizes[] = {
+    1, 2, 1023, 1024, 1025, 2047, 2048, 2049, 3000, 4096, 4097, 10241
+  };
+  const uint32_t flagSets[] = {
+    0, GraphParseReverseOrder, GraphParseUndirected,
+    GraphParseUndirected | GraphParseReverseOrder
+  };
+  srand(1);
+  for (uint32_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+    uint32_t n = sizes[s];
+    char what[64];
+    // Ring
+    Edges ring;
+    for (uint32_t i = 0; i < n; i++) ring.push_back(std::make_pair(i, (i+1) % n));
+    // Random edges in random order, always including the largest node
+    Edges random;
+    for (uint32_t i = 0; i < 4*n; i++)
+      random.push_back(std::make_pair(rand() % n, rand() % n));
+    random.push_back(std::make_pair(n-1, 0));
+    for (uint32_t f = 0; f < sizeof(flagSets)/sizeof(flagSets[0]); f++) {
+      snprintf(what, sizeof(what), "ring of %u nodes", n);
+      ok = check(what, ring, flagSets[f]) && ok;
+      snprintf(what, sizeof(what), "random graph of %u nodes", n);
+      ok = check(what, random, flagSets[f]) && ok;
+    }
+  }
+  printf("%s\n", ok ? "All tests passed" : "Some tests FAILED");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Map generated graphs with POLITE_VERIFY=1, which simulates the
+// programmable routers and exits on any misrouted edge
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <POLite.h>
+
+// Device with several output pins and an edge label
+struct TestState { uint32_t id; };
+struct TestMessage { uint32_t val; };
+struct TestDevice : PDevice<TestState, uint32_t, TestMessage> {};
+typedef PGraph<TestDevice, TestState, uint32_t, TestMessage> TestGraph;
+
+// 2D grid with an edge in each direction between neighbours
+static void grid(TestGraph* graph, uint32_t width, uint32_t height)
+{
+  for (uint32_t i = 0; i < width*height; i++) graph->newDevice();
+  for (uint32_t y = 0; y < height; y++)
+    for (uint32_t x = 0; x < width; x++) {
+      PDeviceId d = y*width + x;
+      if (x < width-1) {
+        graph->addEdge(d, 0, d+1);
+        graph->addEdge(d+1, 0, d);
+      }
+      if (y < height-1) {
+        graph->addEdge(d, 0, d+width);
+        graph->addEdge(d+width, 0, d);
+      }
+    }
+}
+
+// Random labelled edges over a few pins, from a fixed seed
+static void random(TestGraph* graph, uint32_t n, uint32_t degree)
+{
+  uint32_t seed = 1;
+  for (uint32_t i = 0; i < n; i++) graph->newDevice();
+  for (uint32_t i = 0; i < n; i++)
+    for (uint32_t j = 0; j < degree; j++) {
+      seed = seed * 1103515245 + 12345;
+      PDeviceId to = (seed >> 8) % n;
+      PinId pin = (seed >> 4) % 3;
+      graph->addLabelledEdge(j, i, pin, to);
+    }
+}
+
+static int check(const char* name, TestGraph* graph)
+{
+  graph->map();
+  // The mapper has already verified; check again in case it was skipped
+  bool ok = graph->verifyRouting();
+  printf("%s: %s\n", name, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+int main()
+{
+  setenv("POLITE_VERIFY", "1", 1);
+  int failures = 0;
+
+  {
+    TestGraph graph;
+    grid(&graph, 256, 256);
+    failures += check("grid 256x256", &graph);
+  }
+
+  {
+    TestGraph graph;
+    random(&graph, 20000, 16);
+    failures += check("random 20000x16", &graph);
+  }
+
+  {
+    TestGraph graph(2, 1);
+    random(&graph, 50000, 8);
+    failures += check("random 50000x8 over two boxes", &graph);
+  }
+
+  if (failures > 0) {
+    printf("%d tests failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("All tests passed\n");
+  return 0;
+}